@@ -0,0 +1,398 @@
+/* ******************************************************************
+   Benchmark suite and performance regression gate for the simulators.
+
+   Each benchmark runs one protocol through the emulator library on a
+   fixed scenario, in-process and with tracing off, and times sim_run()
+   (or, for many-flow scenarios, the parallel engine that runs them)
+   with the monotonic clock.  The udp scenarios instead run a greedy
+   sender in real time over UDP on the loopback and record the CPU time
+   of the two protocol threads, which is what batching the system calls
+   saves; their wall time is mostly the loopback's round trip.  Every
+   benchmark is repeated a number of times and the samples are written
+   out as JSON:
+
+     {"version": 1, "benchmarks": [
+       {"name": "sr/clean", "unit": "s", "samples": [0.0123, ...]}, ...]}
+
+   In comparison mode (-b baseline.json) the benchmarks are rerun and
+   each one is compared against the stored samples of the same name
+   with a one-sided Mann-Whitney U test.  A benchmark is flagged as a
+   regression when the test says it is slower (p < alpha) AND its median
+   moved by more than the threshold.  The exit status is 1 when any
+   regression is found, so the gate can be used from scripts.
+
+   Usage:
+     bench [-r reps] [-o out.json] [-b baseline.json] [-t threshold]
+           [-a alpha] [-f filter]
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "sr.h"
+#include "gbn.h"
+#include "flows.h"
+#include "pdes.h"
+#include "tw.h"
+#include "workload.h"
+#include "realtime.h"
+#include "udp.h"
+
+#define MAXSAMPLES 256      /* most repetitions of a single benchmark */
+#define MAXBENCH   64       /* most benchmarks in a baseline file */
+#define MAXNAME    64
+
+/* engines a scenario can run on */
+#define ENGINE_CLASSIC      0   /* sim_run(), one flow */
+#define ENGINE_CONSERVATIVE 1   /* pdes_run() */
+#define ENGINE_OPTIMISTIC   2   /* tw_run() */
+#define ENGINE_UDP          3   /* udp_run() */
+
+/* a benchmark scenario: the protocol and the network it runs over */
+struct scenario {
+  const char *name;
+  const struct protocol *proto;
+  long long nsimmax;
+  float lossprob;
+  float corruptprob;
+  int corruptdirection;
+  float lambda;
+  int engine;
+  int nflows;                   /* flows, for the parallel engines */
+  int threads;
+  int rng;                      /* RNG_LIBC or RNG_KEYED */
+  struct udpconfig udp;         /* batching, for ENGINE_UDP */
+};
+
+/* Loss and corruption are kept to the A->B direction: with lost ACKs the
+   SR sender can keep retransmitting forever and the run would not end.
+   The gbn scenario keeps a long event list and so mostly times
+   insertevent().  The flows scenarios run the same 1000 flows on the
+   conservative engine with one thread (the sequential reference) and on
+   both parallel engines with four.  The keyed scenarios repeat sr/lossy
+   and sr/saturated with block-generated keyed numbers instead of
+   rand(), to compare the cost of the two generators.  The udp scenarios
+   send one packet per call, up to 64 per sendmmsg() and 64 per UDP GSO
+   send(), one simulated time unit lasting 10 us. */
+static const struct scenario scenarios[] = {
+  { "sr/clean",     &sr_protocol,  200000, 0.0, 0.0, 0, 10.0 },
+  { "sr/lossy",     &sr_protocol,  100000, 0.2, 0.2, 0, 10.0 },
+  { "sr/saturated", &sr_protocol,  200000, 0.1, 0.1, 0, 1.0 },
+  { "gbn/lossy",    &gbn_protocol, 2000,   0.1, 0.1, 0, 20.0 },
+  { "sr/lossy-keyed",     &sr_protocol, 100000, 0.2, 0.2, 0, 10.0, ENGINE_CLASSIC, 0, 0, RNG_KEYED },
+  { "sr/saturated-keyed", &sr_protocol, 200000, 0.1, 0.1, 0, 1.0,  ENGINE_CLASSIC, 0, 0, RNG_KEYED },
+  { "flows/seq",        &sr_protocol, 100, 0.1, 0.1, 0, 10.0, ENGINE_CONSERVATIVE, 1000, 1 },
+  { "flows/pdes",       &sr_protocol, 100, 0.1, 0.1, 0, 10.0, ENGINE_CONSERVATIVE, 1000, 4 },
+  { "flows/timewarp",   &sr_protocol, 100, 0.1, 0.1, 0, 10.0, ENGINE_OPTIMISTIC,   1000, 4 },
+  { "udp/send",     &sr_protocol, 50000, 0.0, 0.0, 0, 0.0, ENGINE_UDP, 0, 0, RNG_KEYED, { 1, 0 } },
+  { "udp/sendmmsg", &sr_protocol, 50000, 0.0, 0.0, 0, 0.0, ENGINE_UDP, 0, 0, RNG_KEYED, { UDP_BATCH, 0 } },
+  { "udp/gso",      &sr_protocol, 50000, 0.0, 0.0, 0, 0.0, ENGINE_UDP, 0, 0, RNG_KEYED, { UDP_BATCH, 1 } },
+};
+#define NSCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+struct result {
+  char name[MAXNAME];
+  int n;
+  double samples[MAXSAMPLES];
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* simulate one scenario, return the wall time of the run in seconds (the
+   CPU time of the protocol for a udp one) */
+static double runonce(const struct scenario *sc)
+{
+  struct simconfig cfg;
+  struct sim *s;
+  struct flows *f;
+  struct twstats tws;
+  struct rtresult rt;
+  double start, elapsed;
+
+  simconfig_default(&cfg);
+  cfg.nsimmax = sc->nsimmax;
+  cfg.lossprob = sc->lossprob;
+  cfg.corruptprob = sc->corruptprob;
+  cfg.corruptdirection = sc->corruptdirection;
+  cfg.lambda = sc->lambda;
+  cfg.rng = sc->rng;
+
+  if (sc->engine == ENGINE_UDP) {
+    cfg.workload = WL_GREEDY;
+    udp_run(sc->proto, &cfg, 1e-5, 0, &sc->udp, &rt);
+    return rt.cpu;
+  }
+
+  if (sc->engine != ENGINE_CLASSIC) {
+    f = flows_create(sc->proto, &cfg, sc->nflows);
+    start = now();
+    if (sc->engine == ENGINE_CONSERVATIVE)
+      pdes_run(f, sc->threads);
+    else
+      tw_run(f, sc->threads, &tws);
+    elapsed = now() - start;
+    flows_destroy(f);
+    return elapsed;
+  }
+
+  s = sim_create(sc->proto, &cfg);
+  start = now();
+  sim_run(s);
+  elapsed = now() - start;
+  sim_destroy(s);
+  return elapsed;
+}
+
+/********************* JSON output and input ****************************/
+
+static void writejson(FILE *f, const struct result *res, int nres)
+{
+  int i, j;
+
+  fprintf(f, "{\"version\": 1, \"benchmarks\": [\n");
+  for (i = 0; i < nres; i++) {
+    fprintf(f, "  {\"name\": \"%s\", \"unit\": \"s\", \"samples\": [", res[i].name);
+    for (j = 0; j < res[i].n; j++)
+      fprintf(f, "%s%.9g", j ? ", " : "", res[i].samples[j]);
+    fprintf(f, "]}%s\n", i < nres - 1 ? "," : "");
+  }
+  fprintf(f, "]}\n");
+}
+
+/* Read a file written by writejson().  This is not a general JSON
+   parser: it looks for each "name" string and the "samples" array that
+   follows it, which is all the baseline format contains. */
+static int readjson(const char *path, struct result *res, int maxres)
+{
+  FILE *f;
+  char *buf, *p, *q;
+  long len;
+  int nres = 0;
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    printf("bench: cannot open baseline %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  rewind(f);
+  buf = malloc(len + 1);
+  if (buf == NULL) {
+    printf("bench: memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  len = fread(buf, 1, len, f);
+  buf[len] = '\0';
+  fclose(f);
+
+  for (p = buf; nres < maxres && (p = strstr(p, "\"name\"")) != NULL; ) {
+    struct result *r = &res[nres];
+    size_t n;
+
+    p = strchr(p + 6, '"');
+    if (p == NULL)
+      break;
+    q = strchr(++p, '"');
+    if (q == NULL)
+      break;
+    n = q - p < MAXNAME - 1 ? (size_t)(q - p) : MAXNAME - 1;
+    memcpy(r->name, p, n);
+    r->name[n] = '\0';
+
+    p = strstr(q, "\"samples\"");
+    if (p == NULL || (p = strchr(p, '[')) == NULL)
+      break;
+    r->n = 0;
+    for (p++; r->n < MAXSAMPLES; ) {
+      r->samples[r->n++] = strtod(p, &q);
+      if (q == p) {       /* empty array */
+        r->n--;
+        break;
+      }
+      p = q + strspn(q, " \t\r\n");
+      if (*p != ',')
+        break;
+      p++;
+    }
+    nres++;
+  }
+  free(buf);
+  return nres;
+}
+
+/********************* statistics ****************************************/
+
+static int cmpdouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double median(const double *v, int n)
+{
+  double s[MAXSAMPLES];
+
+  memcpy(s, v, n * sizeof(double));
+  qsort(s, n, sizeof(double), cmpdouble);
+  return n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+}
+
+/* One-sided Mann-Whitney U test that the samples in x tend to be larger
+   (slower) than those in y.  Uses the normal approximation with tie
+   correction and continuity correction, which is adequate from about
+   five samples per side; returns the p-value. */
+static double mannwhitney(const double *x, int nx, const double *y, int ny)
+{
+  double all[2 * MAXSAMPLES];
+  int from[2 * MAXSAMPLES];
+  double rank[2 * MAXSAMPLES];
+  double rx = 0.0, u, mu, sigma, ties = 0.0, z;
+  int n = nx + ny, i, j, k;
+
+  /* sort the pooled samples, remembering which side each came from */
+  for (i = 0; i < nx; i++) {
+    all[i] = x[i];
+    from[i] = 0;
+  }
+  for (i = 0; i < ny; i++) {
+    all[nx + i] = y[i];
+    from[nx + i] = 1;
+  }
+  for (i = 1; i < n; i++)       /* insertion sort: n is small */
+    for (j = i; j > 0 && all[j - 1] > all[j]; j--) {
+      double t = all[j]; all[j] = all[j - 1]; all[j - 1] = t;
+      k = from[j]; from[j] = from[j - 1]; from[j - 1] = k;
+    }
+
+  /* average ranks over runs of ties */
+  for (i = 0; i < n; i = j) {
+    for (j = i + 1; j < n && all[j] == all[i]; j++)
+      ;
+    for (k = i; k < j; k++)
+      rank[k] = (i + j + 1) / 2.0;
+    ties += (double)(j - i) * (j - i) * (j - i) - (j - i);
+  }
+  for (i = 0; i < n; i++)
+    if (from[i] == 0)
+      rx += rank[i];
+
+  u = rx - nx * (nx + 1) / 2.0;
+  mu = nx * ny / 2.0;
+  sigma = sqrt(nx * ny / 12.0 * ((n + 1) - ties / ((double)n * (n - 1))));
+  if (sigma == 0.0)
+    return 0.5;
+  z = (u - mu - 0.5) / sigma;
+  return 0.5 * erfc(z / sqrt(2.0));
+}
+
+/* compare current results against a baseline, return number of regressions */
+static int compare(const struct result *cur, int ncur,
+                   const struct result *base, int nbase,
+                   double threshold, double alpha)
+{
+  int i, j, regressions = 0;
+
+  printf("%-20s %12s %12s %8s %10s  %s\n",
+         "benchmark", "base med", "new med", "change", "p(slower)", "verdict");
+  for (i = 0; i < ncur; i++) {
+    double mb, mc, change, p;
+    const char *verdict;
+
+    for (j = 0; j < nbase && strcmp(base[j].name, cur[i].name) != 0; j++)
+      ;
+    if (j == nbase || base[j].n == 0) {
+      printf("%-20s %12s %12.6f %8s %10s  new\n", cur[i].name, "-",
+             median(cur[i].samples, cur[i].n), "-", "-");
+      continue;
+    }
+    mb = median(base[j].samples, base[j].n);
+    mc = median(cur[i].samples, cur[i].n);
+    change = mc / mb - 1.0;
+    p = mannwhitney(cur[i].samples, cur[i].n, base[j].samples, base[j].n);
+    if (p < alpha && change > threshold) {
+      verdict = "REGRESSION";
+      regressions++;
+    }
+    else
+      verdict = "ok";
+    printf("%-20s %12.6f %12.6f %+7.1f%% %10.4f  %s\n",
+           cur[i].name, mb, mc, 100.0 * change, p, verdict);
+  }
+  return regressions;
+}
+
+static void usage(void)
+{
+  printf("usage: bench [-r reps] [-o out.json] [-b baseline.json] [-t threshold]\n"
+         "             [-a alpha] [-f filter]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  static struct result cur[NSCENARIOS], base[MAXBENCH];
+  const char *outpath = NULL, *basepath = NULL, *filter = NULL;
+  double threshold = 0.05, alpha = 0.01;
+  int reps = 10, ncur = 0, nbase, c, j;
+  size_t i;
+
+  while ((c = getopt(argc, argv, "r:o:b:t:a:f:")) != -1) {
+    switch (c) {
+    case 'r': reps = atoi(optarg); break;
+    case 'o': outpath = optarg; break;
+    case 'b': basepath = optarg; break;
+    case 't': threshold = atof(optarg); break;
+    case 'a': alpha = atof(optarg); break;
+    case 'f': filter = optarg; break;
+    default: usage();
+    }
+  }
+  if (reps < 1 || reps > MAXSAMPLES || optind < argc)
+    usage();
+  TRACE = -1;                 /* not even warnings */
+
+  for (i = 0; i < NSCENARIOS; i++) {
+    const struct scenario *s = &scenarios[i];
+    struct result *r = &cur[ncur];
+
+    if (filter != NULL && strstr(s->name, filter) == NULL)
+      continue;
+    snprintf(r->name, MAXNAME, "%s", s->name);
+    runonce(s);                 /* warm caches */
+    for (j = 0; j < reps; j++)
+      r->samples[r->n++] = runonce(s);
+    fprintf(stderr, "%-20s median %.6f s over %d runs\n", r->name,
+            median(r->samples, r->n), r->n);
+    ncur++;
+  }
+
+  if (outpath != NULL) {
+    FILE *f = fopen(outpath, "w");
+    if (f == NULL) {
+      printf("bench: cannot write %s\n", outpath);
+      exit(EXIT_FAILURE);
+    }
+    writejson(f, cur, ncur);
+    fclose(f);
+  }
+  else if (basepath == NULL)
+    writejson(stdout, cur, ncur);
+
+  if (basepath != NULL) {
+    nbase = readjson(basepath, base, MAXBENCH);
+    if (compare(cur, ncur, base, nbase, threshold, alpha) > 0) {
+      printf("performance regression detected\n");
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
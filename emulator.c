@@ -33,23 +33,41 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Modifications (library):
+   - the emulator is a library: all state lives in a struct sim, protocols
+   are reached through a struct protocol table and main() lives in main.c,
+   so several protocols and simulations can share one program.
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "rng.h"
+#include "stats.h"
+#include "replay.h"
+#include "workload.h"
+
+/* Simulated time.  With cfg.ticks > 0 it counts ticks of 1/cfg.ticks
+   time units, exact however long the run; with cfg.ticks == 0 it holds
+   the bits of a float, the original clock, whose order as integers is
+   the order of the (never negative) times.  Either way the event list
+   compares integers, and only the helpers below know the difference. */
+typedef int64_t simtime;
 
 struct event {
-  float evtime;           /* event time */
+  simtime evtime;         /* event time */
+  uint64_t stamp;         /* insertion order, to break ties */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  struct pkt pkt;         /* packet (if any) assoc w/ this event */
   struct event *prev;
-  struct event *next;
+  struct event *next;     /* also links the pool of free events */
 };
 
-struct event *evlist = NULL;   /* the event list */
-
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
@@ -60,37 +78,107 @@ struct event *evlist = NULL;   /* the event list */
 
 int TRACE = 3;
 
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+_Thread_local struct host *curhost;   /* host of the entity now running */
+
+#define  CONV_BATCHES    32     /* batches for the convergence test */
+#define  CONV_LEVEL      0.95   /* its confidence level */
+#define  WALL_EVERY      1024   /* events between wall-clock checks */
+
+/* Keyed numbers are made RNG_BLOCK at a time: draws within a stream
+   mostly come in index order, so a draw is usually a load from the
+   block, and filling a block is a loop without branches. */
+#define  RNG_BLOCK       256
+
+struct rngblock {
+  uint64_t first;               /* index of u[0] */
+  double u[RNG_BLOCK];
+};
+
+#define  NSTREAMS        5
+
+struct sim {
+  const struct protocol *proto;
+  struct simconfig cfg;
+  void *ctx[2];                 /* protocol state of A and B */
+  struct host host;
+  struct protostats stats;      /* statistics updated by the protocol */
+  int started;                  /* initialised: sim_run() resumes the run */
+  FILE *record;                 /* log of the calls into the protocol, or NULL */
+
+  struct event *evlist;         /* the event list */
+  struct event arrival;         /* the next arrival, if arrivalpending */
+  int arrivalpending;
+  uint64_t nstamps;             /* events inserted so far */
+  struct event *freeevents;     /* events to reuse */
+  long nevents;                 /* events allocated, in the list or free */
+  simtime time;
+  long long nsim;               /* number of messages from 5 to 4 so far */
+
+  /* statistics updated by emulator */
+  long long messages_delivered;
+  long long ntolayer3;          /* number sent into layer 3 */
+  long long nlost;              /* number lost in media */
+  long long ncorrupt;           /* number corrupted by media*/
+
+  /* Delivery latency.  Both protocols deliver every accepted message
+     once and in order, so the acceptance times of messages still on
+     their way form a FIFO and each delivery at B pops its head. */
+  simtime *accepted;            /* ring of acceptance times */
+  int acceptsize, accepthead, acceptcount;
+  double latency_sum;
+  float latency_max;
+  long long latency_n;
+
+  /* warm-up deletion: statistics are reset when the warm-up ends */
+  simtime starttime;            /* time statistics are collected from */
+  int warm;                     /* still warming up */
+  double batchsum;              /* the MSER-5 batch being filled */
+  int batchn;
+  double *batches;              /* means of the completed batches */
+  int nbatches, maxbatches, nextcheck;
+
+  /* stopping */
+  int stopreason;               /* STOP_DRAINED until a stop condition fires */
+  double wallstart;             /* wall-clock time sim_run() started */
+  double convsum;               /* the latency batch being filled */
+  long long convn, convsize;
+  double convbatch[2*CONV_BATCHES];  /* batch means for the convergence test */
+  int nconv;
+
+  uint64_t nrand;               /* rand() calls since srand() (RNG_LIBC) */
+
+  /* keyed random number streams (cfg.rng == RNG_KEYED) */
+  uint64_t key[NSTREAMS];       /* see STREAM_... below */
+  struct rngblock block[NSTREAMS];  /* the numbers of each stream drawn ahead */
+  uint64_t narrivals;           /* arrivals generated so far */
+  struct wlstate wl;            /* the workload model's state */
+  uint64_t ntx[2];              /* packets sent by A and by B so far */
+
+  /* skip-ahead (cfg.skipahead): packets of each direction still to
+     pass before the next loss and the next corruption, -1 when not yet
+     drawn; and the gaps drawn so far */
+  long gapleft[2][2];
+  uint64_t ngaps[2];
+
+  /* importance sampling (cfg.is_lossprob > 0) */
+  double logweight;             /* log likelihood ratio of the run so far */
+  long long nlate;              /* deliveries later than cfg.late_latency */
+};
+
+/* random number streams, and the draws made for each packet */
+#define  STREAM_ARRIVAL  0
+#define  STREAM_CHANNEL  1      /* + A or B, the sending entity */
+#define  STREAM_GAP      3      /* + A or B: skip-ahead gaps */
+#define  NDRAWS          CHANNEL_DRAWS
+#define  GAP_LOSS        0      /* draws of a skip-ahead gap */
+#define  GAP_CORRUPT     1
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
 /* isolate all random number generation in one location.  We assume that the*/
 /* system-supplied rand() function return an int in therange [0,mmm]        */
 /****************************************************************************/
-double jimsrand(void) 
+static double jimsrand(void) 
 {
   double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
   double x;                   
@@ -100,21 +188,111 @@ double jimsrand(void)
   return(x);
 }  
 
+/* Draw 'which' of item 'index' of a stream.  With the classic generator
+   this is just the next rand() number; keyed draws depend only on the
+   arguments, so the same packet always meets the same fate. */
+static double draw(struct sim *s, int stream, uint64_t index, int which)
+{
+  struct rngblock *b = &s->block[stream];
+  uint64_t i = index * NDRAWS + which;
+  double x;
+
+  if (s->cfg.rng == RNG_LIBC) {
+    s->nrand++;
+    return jimsrand();
+  }
+  if (i - b->first >= RNG_BLOCK) {
+    b->first = i - i % RNG_BLOCK;
+    rng_fill(s->key[stream], b->first, b->u, RNG_BLOCK);
+  }
+  x = b->u[i - b->first];
+  if (TRACE > 3)
+    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
+  return x;
+}
+
+/********************* the clock ***********************************/
+
+/* simulated time t as a clock value */
+static simtime totick(const struct sim *s, double t)
+{
+  float f = t;
+  uint32_t bits;
+
+  if (s->cfg.ticks > 0)
+    return llround(t * s->cfg.ticks);
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+/* a clock value in time units */
+static double totime(const struct sim *s, simtime k)
+{
+  uint32_t bits = k;
+  float f;
+
+  if (s->cfg.ticks > 0)
+    return k / s->cfg.ticks;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/* dt time units after clock value k; with the float clock, rounded to
+   float exactly as the original 'float time + double dt' was */
+static simtime later(const struct sim *s, simtime k, double dt)
+{
+  if (s->cfg.ticks > 0)
+    return k + llround(dt * s->cfg.ticks);
+  return totick(s, totime(s, k) + dt);
+}
+
+static void *xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (p == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* Events are recycled rather than freed, so a run allocates only as
+   many as are ever pending at once (a window's worth of packets and
+   two timers) however many messages it simulates. */
+static struct event *newevent(struct sim *s)
+{
+  struct event *e = s->freeevents;
+
+  if (e == NULL) {
+    s->nevents++;
+    return xmalloc(sizeof(struct event));
+  }
+  s->freeevents = e->next;
+  return e;
+}
+
+static void freeevent(struct sim *s, struct event *e)
+{
+  e->next = s->freeevents;
+  s->freeevents = e;
+}
+
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+static void insertevent(struct sim *s, struct event *p)
 {
   struct event *q,*qold;
 
   if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+    printf("            INSERTEVENT: time is %f\n",totime(s, s->time));
+    printf("            INSERTEVENT: future time will be %f\n",totime(s, p->evtime)); 
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
+  p->stamp = s->nstamps++;
+  q = s->evlist;  /* q points to front of list in which p struct inserted */
   if (q==NULL) {   /* list is empty */
-    evlist=p;
+    s->evlist=p;
     p->next=NULL;
     p->prev=NULL;
   }
@@ -126,11 +304,11 @@ void insertevent(struct event *p)
       p->prev = qold;
       p->next = NULL;
     }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
+    else if (q==s->evlist) { /* front of list */
+      p->next=s->evlist;
       p->prev=NULL;
       p->next->prev=p;
-      evlist = p;
+      s->evlist = p;
     }
     else {     /* middle of list */
       p->next=q;
@@ -141,173 +319,322 @@ void insertevent(struct event *p)
   }
 }
 
-void generate_next_arrival(void)
+/* The next arrival from layer 5 is not kept in the event list but in
+   its own slot, so the arrival stream costs no allocation and no walk
+   down the list, and when the network is idle the main loop jumps
+   straight to it.  It is ordered against the list exactly as if it had
+   been inserted: on equal times the later insertion comes first. */
+static double arrivaldraw(void *arg, int which)
+{
+  struct sim *s = arg;
+
+  return draw(s, STREAM_ARRIVAL, s->narrivals, which);
+}
+
+static void generate_next_arrival(struct sim *s)
 {
   double x;
-  struct event *evptr;
+  struct event *evptr = &s->arrival;
 
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
+  /* the gap, of mean lambda, from the workload model */
+  x = workload_gap(&s->cfg, &s->wl, totime(s, s->time), arrivaldraw, s);
+  if (x == WL_END)
+    return;
+  evptr->evtime =  later(s, s->time, x);
   evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
+  if (BIDIRECTIONAL && (draw(s, STREAM_ARRIVAL, s->narrivals, 1)>0.5) )
     evptr->eventity = B;
   else
     evptr->eventity = A;
-  insertevent(evptr);
+  s->narrivals++;
+  if (TRACE>2) {
+    printf("            INSERTEVENT: time is %f\n",totime(s, s->time));
+    printf("            INSERTEVENT: future time will be %f\n",totime(s, evptr->evtime)); 
+  }
+  evptr->stamp = s->nstamps++;
+  s->arrivalpending = 1;
 } 
 
-void printevlist(void)
+/* the next event to simulate, or NULL */
+static struct event *nextevent(const struct sim *s)
+{
+  struct event *q = s->evlist;
+
+  if (s->arrivalpending &&
+      (q == NULL || s->arrival.evtime < q->evtime ||
+       (s->arrival.evtime == q->evtime && s->arrival.stamp > q->stamp)))
+    return (struct event *)&s->arrival;
+  return q;
+}
+
+void printevlist(const struct sim *s)
 {
   struct event *q;
   printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  for(q = s->evlist; q!=NULL; q=q->next) {
+    printf("Event time: %f, type: %d entity: %d\n",totime(s, q->evtime),q->evtype,q->eventity);
   }
   printf("--------------\n");
 }
 
-void init(void)                         /* initialize the simulator */
+/********************* WARM-UP DELETION *************************/
+
+/* forget everything measured so far; statistics start again now */
+static void resetstats(struct sim *s)
 {
-  float sum, avg;
-  int i;
+  s->stats.window_full = 0;
+  s->stats.total_ACKs_received = 0;
+  s->stats.packets_resent = 0;
+  s->stats.new_ACKs = 0;
+  s->stats.packets_received = 0;
+  s->messages_delivered = 0;
+  s->latency_sum = 0.0;
+  s->latency_max = 0.0;
+  s->latency_n = 0;
+  s->ntolayer3 = 0;
+  s->nlost = 0;
+  s->ncorrupt = 0;
+  s->nlate = 0;
+  s->starttime = s->time;
+}
 
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
-  }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
-
-
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-    exit(EXIT_FAILURE);
+static void endwarmup(struct sim *s)
+{
+  if (TRACE>1)
+    printf("          WARM-UP: ends at %f, statistics reset\n", totime(s, s->time));
+  resetstats(s);
+  s->warm = 0;
+  free(s->batches);
+  s->batches = NULL;
+  s->nbatches = s->maxbatches = 0;
+}
+
+#define  MSER_BATCH      5      /* observations per batch: MSER-5 */
+#define  MSER_MIN        20     /* batches before the first check */
+#define  MSER_TAIL       5      /* last batches never taken as the cut */
+#define  MSER_MAXBATCHES (1<<20)  /* give up after this many */
+
+/* MSER truncation point of the series y[0..k-1]: the d in
+   [0, k-MSER_TAIL] that minimises the variance of the mean of y[d..k-1]
+   per remaining sample, sum((y[j] - mean)^2) / (k-d)^2.  The few batches
+   at the very end are left out, where the statistic is meaningless. */
+static int mser(const double *y, int k)
+{
+  double sum = 0.0, sumsq = 0.0, best = 0.0, v;
+  int d, m, bestd = k;
+
+  for (d = k-1; d >= 0; d--) {
+    sum += y[d];
+    sumsq += y[d]*y[d];
+    m = k - d;
+    v = (sumsq - sum*sum/m) / ((double)m*m);
+    if (d <= k - MSER_TAIL && (bestd == k || v <= best)) {
+      best = v;
+      bestd = d;
+    }
   }
+  return bestd;
+}
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
+/* Feed one observation of the output process (a delivery latency) to the
+   steady-state detector.  The MSER-5 statistic is evaluated on the batch
+   means at geometrically spaced points; once its truncation point, looked
+   for over the whole series, falls in the first half of the data the
+   transient is over, and since the counters cannot be rewound to that
+   point they are reset now.  While the best cut is still in the second
+   half the output has not settled and more batches are collected. */
+static void mser_observe(struct sim *s, double x)
+{
+  double *p;
+
+  s->batchsum += x;
+  if (++s->batchn < MSER_BATCH)
+    return;
+  if (s->nbatches == s->maxbatches) {
+    if (s->maxbatches == MSER_MAXBATCHES)
+      return;                   /* never settled: keep everything */
+    s->maxbatches = s->maxbatches ? 2*s->maxbatches : 64;
+    p = realloc(s->batches, s->maxbatches * sizeof(double));
+    if (p == NULL) {
+      printf("memory allocation for steady-state detection failed.");
+      exit(EXIT_FAILURE);
+    }
+    s->batches = p;
+  }
+  s->batches[s->nbatches++] = s->batchsum / MSER_BATCH;
+  s->batchsum = 0.0;
+  s->batchn = 0;
 
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+  if (s->nbatches >= s->nextcheck) {
+    s->nextcheck = s->nbatches + (s->nbatches/4 > 10 ? s->nbatches/4 : 10);
+    if (2*mser(s->batches, s->nbatches) < s->nbatches)
+      endwarmup(s);
+  }
+}
+
+/********************* STOPPING *************************/
+
+static double wallclock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Feed one delivery latency to the convergence test.  Latencies are
+   averaged in batches; when 2*CONV_BATCHES batches are full, neighbours
+   are merged and the batch size doubles, so memory stays fixed and the
+   batches grow long enough to be nearly independent.  The run has
+   converged once the confidence interval of the mean latency computed
+   from the batch means is within stop_precision of it. */
+static void converge_observe(struct sim *s, double x)
+{
+  struct summary sum;
+  int i;
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  s->convsum += x;
+  if (++s->convn < s->convsize)
+    return;
+  s->convbatch[s->nconv++] = s->convsum / s->convsize;
+  s->convsum = 0.0;
+  s->convn = 0;
+  if (s->nconv == 2*CONV_BATCHES) {
+    for (i = 0; i < CONV_BATCHES; i++)
+      s->convbatch[i] = (s->convbatch[2*i] + s->convbatch[2*i+1]) / 2;
+    s->nconv = CONV_BATCHES;
+    s->convsize *= 2;
+  }
+  if (s->nconv < CONV_BATCHES)
+    return;
+  summary_init(&sum);
+  for (i = 0; i < s->nconv; i++)
+    summary_add(&sum, s->convbatch[i]);
+  if (summary_halfwidth(&sum, CONV_LEVEL) <= s->cfg.stop_precision * sum.mean)
+    s->stopreason = STOP_CONVERGED;
 }
 
 /********************** Student-callable ROUTINES ***********************/
 
 /* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
+static void sim_stoptimer(void *eng, int AorB)
 /* A or B is trying to stop timer */
 {
+  struct sim *s = eng;
   struct event *q;
 
   if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
+    printf("          STOP TIMER: stopping timer at %f\n",totime(s, s->time));
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
+  for (q=s->evlist; q!=NULL ; q = q->next) 
     if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
       /* remove this event */
       if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
+        s->evlist=NULL;      /* remove first and only event on list */
       else if (q->next==NULL) /* end of list - there is one in front */
         q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
+      else if (q==s->evlist) { /* front of list - there must be event after */
         q->next->prev=NULL;
-        evlist = q->next;
+        s->evlist = q->next;
       }
       else {     /* middle of list */
         q->next->prev = q->prev;
         q->prev->next =  q->next;
       }
-      free(q);
+      freeevent(s, q);
       return;
     }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+  if (TRACE>=0)
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
 
-void starttimer(int AorB, double increment)
+static void sim_starttimer(void *eng, int AorB, double increment)
 /* A or B is trying to start timer */
 {
-
+  struct sim *s = eng;
   struct event *q;
   struct event *evptr;
 
   if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+    printf("          START TIMER: starting timer at %f\n",totime(s, s->time));
   /* be nice: check to see if timer is already started, if so, then  warn */
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
+  for (q=s->evlist; q!=NULL ; q = q->next)  
     if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
+      if (TRACE>=0)
+        printf("Warning: attempt to start a timer that is already started\n");
       return;
     }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
+  evptr = newevent(s);
+  evptr->evtime =  later(s, s->time, increment);
   evptr->evtype =  TIMER_INTERRUPT;
    
  
   evptr->eventity = AorB;
-  insertevent(evptr);
+  insertevent(s, evptr);
 } 
 
 
+/* Skip-ahead: does the next packet from AorB meet the event 'kind'
+   (GAP_LOSS or GAP_CORRUPT) of probability p?  The packets until the
+   next event are geometrically distributed, so one draw decides a whole
+   run of packets; the events fall exactly as if every packet had been
+   decided on its own. */
+static int skipahead(struct sim *s, int AorB, int kind, double p)
+{
+  long *left = &s->gapleft[AorB][kind];
+  double u;
+
+  if (p <= 0.0)
+    return 0;
+  if (p >= 1.0)
+    return 1;
+  if (*left < 0) {
+    u = draw(s, STREAM_GAP + AorB, s->ngaps[AorB]++, kind);
+    if (u >= 1.0)               /* rand() can return RAND_MAX */
+      u = 0.0;
+    /* packets before the event: floor(log(1-u) / log(1-p)) */
+    u = floor(log1p(-u) / log1p(-p));
+    *left = u < LONG_MAX ? (long)u : LONG_MAX;
+  }
+  if ((*left)-- == 0)
+    return 1;
+  return 0;
+}
+
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
+static void sim_tolayer3(void *eng, int AorB, struct pkt packet)
 /* A or B is sending to network  */
 {
+  struct sim *s = eng;
   struct pkt *mypktptr;
   struct event *evptr,*q;
-  float lastime, x;
+  simtime lastime;
+  float x;
   int i;
+  int corruptdirection = s->cfg.corruptdirection;
+  int affected = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  int stream = STREAM_CHANNEL + AorB;
+  uint64_t tx = s->ntx[AorB]++;    /* index of this packet in its direction */
+  /* under importance sampling, losses happen with the biased probability */
+  float lossprob = s->cfg.is_lossprob > 0 ? s->cfg.is_lossprob : s->cfg.lossprob;
+  int lost;
 
-  ntolayer3++;
+  s->ntolayer3++;
 
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
+  lost = s->cfg.skipahead ? affected && skipahead(s, AorB, GAP_LOSS, lossprob) :
+      draw(s, stream, tx, DRAW_LOSS) < lossprob && affected;
+  if (s->cfg.is_lossprob > 0 && affected)     /* likelihood ratio of this decision */
+    s->logweight += lost ? log((double)s->cfg.lossprob / lossprob) :
+      log1p(-(double)s->cfg.lossprob) - log1p(-(double)lossprob);
+  if (lost) {
+    s->nlost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
     return;
@@ -315,11 +642,8 @@ void tolayer3(int AorB, struct pkt packet)
 
   /* make a copy of the packet student just gave me since he/she may decide */
   /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = newevent(s);
+  mypktptr = &evptr->pkt;
   mypktptr->seqnum = packet.seqnum;
   mypktptr->acknum = packet.acknum;
   mypktptr->checksum = packet.checksum;
@@ -334,31 +658,26 @@ void tolayer3(int AorB, struct pkt packet)
   }
 
   /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
      currently in the medium on their way to the destination */
-  lastime = time;
+  lastime = s->time;
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
+  for (q=s->evlist; q!=NULL ; q = q->next) 
     if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
       lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
+  evptr->evtime =  later(s, later(s, lastime, 1), 9*draw(s, stream, tx, DRAW_DELAY));
  
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
+  if (s->cfg.skipahead ? affected && skipahead(s, AorB, GAP_CORRUPT, s->cfg.corruptprob) :
+      (draw(s, stream, tx, DRAW_CORRUPT) < s->cfg.corruptprob) && affected) {
+    s->ncorrupt++;
+    if ( (x = draw(s, stream, tx, DRAW_CORRUPTION)) < .75)
       mypktptr->payload[0]='Z';   /* corrupt payload */
     else if (x < .875)
       mypktptr->seqnum = 999999;
@@ -370,11 +689,64 @@ void tolayer3(int AorB, struct pkt packet)
 
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  insertevent(s, evptr);
 } 
 
-void tolayer5(int AorB, char datasent[20])
+/* The channel of tolayer3() for engines other than the one above, with
+   keyed random numbers only.  channel_decide() applies the draws u[]
+   (DRAW_LOSS to DRAW_CORRUPTION) to a packet sent by AorB: it returns
+   CHANNEL_LOST, or the delay (1 to 10 time units) to add to the later
+   of now and the last arrival in that direction, and may corrupt
+   *packet and then sets *corrupted.  channel_fate() makes the draws for
+   the tx-th packet of the channel whose stream key is 'key', the same
+   ones sim_tolayer3() makes in keyed mode. */
+double channel_decide(const struct simconfig *cfg, int AorB, const double u[CHANNEL_DRAWS],
+                      struct pkt *packet, int *corrupted)
 {
+  int affected = !(AorB == B && cfg->corruptdirection == A) &&
+                 !(AorB == A && cfg->corruptdirection == B);
+
+  *corrupted = 0;
+  if (affected && u[DRAW_LOSS] < cfg->lossprob)
+    return CHANNEL_LOST;
+  if (affected && u[DRAW_CORRUPT] < cfg->corruptprob) {
+    *corrupted = 1;
+    if (u[DRAW_CORRUPTION] < .75)
+      packet->payload[0]='Z';   /* corrupt payload */
+    else if (u[DRAW_CORRUPTION] < .875)
+      packet->seqnum = 999999;
+    else
+      packet->acknum = 999999;
+  }
+  return 1 + 9*u[DRAW_DELAY];
+}
+
+double channel_fate(const struct simconfig *cfg, uint64_t key, uint64_t tx,
+                    int AorB, struct pkt *packet, int *corrupted)
+{
+  double u[CHANNEL_DRAWS];
+  int i;
+
+  for (i = 0; i < CHANNEL_DRAWS; i++)
+    u[i] = rng_uniform(key, tx*NDRAWS + i);
+  return channel_decide(cfg, AorB, u, packet, corrupted);
+}
+
+int greedy_offer(const struct protocol *proto, void *ctx, struct msg m,
+                 struct protostats *stats)
+{
+  long long dropped = stats->window_full;
+
+  proto->A_output(ctx, m);
+  if (stats->window_full == dropped)
+    return 1;
+  stats->window_full = dropped;
+  return 0;
+}
+
+static void sim_tolayer5(void *eng, int AorB, char datasent[20])
+{
+  struct sim *s = eng;
   int i;  
   if (TRACE>2) {
     printf("          TOLAYER5: data received by application at ");
@@ -386,30 +758,288 @@ void tolayer5(int AorB, char datasent[20])
       printf("%c",datasent[i]);
     printf("\n");
   }
-  messages_delivered++;
+  s->messages_delivered++;
+  if (AorB == B && s->acceptcount > 0) {
+    float latency = totime(s, s->time) - totime(s, s->accepted[s->accepthead]);
+
+    s->accepthead = (s->accepthead + 1) % s->acceptsize;
+    s->acceptcount--;
+    s->latency_sum += latency;
+    s->latency_n++;
+    if (s->cfg.late_latency > 0 && latency > s->cfg.late_latency)
+      s->nlate++;
+    if (latency > s->latency_max)
+      s->latency_max = latency;
+    if (s->warm && s->cfg.mser)
+      mser_observe(s, latency);
+    else if (!s->warm && s->cfg.stop_precision > 0)
+      converge_observe(s, latency);
+  }
 }
 
-int main(void)
+/* remember that A accepted a message from layer 5 at the current time */
+static void accept(struct sim *s)
 {
-  struct event *eventptr;
+  int i, n;
+
+  if (s->acceptcount == s->acceptsize) {      /* grow the ring */
+    n = s->acceptsize ? 2 * s->acceptsize : 16;
+    s->accepted = realloc(s->accepted, n * sizeof(simtime));
+    if (s->accepted == NULL) {
+      printf("memory allocation for latency tracking failed.");
+      exit(EXIT_FAILURE);
+    }
+    /* unwrap the part that wrapped around the old end */
+    for (i = 0; i < s->accepthead + s->acceptcount - s->acceptsize; i++)
+      s->accepted[s->acceptsize + i] = s->accepted[i];
+    s->acceptsize = n;
+  }
+  s->accepted[(s->accepthead + s->acceptcount) % s->acceptsize] = s->time;
+  s->acceptcount++;
+}
+
+static const struct hostops simops = {
+  sim_tolayer3, sim_tolayer5, sim_starttimer, sim_stoptimer
+};
+
+/* the student-callable routines act on the host of the running entity */
+void tolayer3(int AorB, struct pkt packet)
+{
+  curhost->ops->tolayer3(curhost->eng, AorB, packet);
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  curhost->ops->tolayer5(curhost->eng, AorB, datasent);
+}
+
+void starttimer(int AorB, double increment)
+{
+  curhost->ops->starttimer(curhost->eng, AorB, increment);
+}
+
+void stoptimer(int AorB)
+{
+  curhost->ops->stoptimer(curhost->eng, AorB);
+}
+
+/********************** SIMULATION ***********************/
+
+void simconfig_default(struct simconfig *cfg)
+{
+  cfg->nsimmax = 0;
+  cfg->lossprob = 0.0;
+  cfg->corruptprob = 0.0;
+  cfg->corruptdirection = 0;
+  cfg->lambda = 0.0;
+  cfg->workload = WL_UNIFORM;
+  cfg->burst_on = 0.0;
+  cfg->burst_off = 0.0;
+  cfg->pareto_shape = 0.0;
+  cfg->trace = NULL;
+  cfg->ntrace = 0;
+  cfg->seed = 9999;
+  cfg->rng = RNG_LIBC;
+  cfg->skipahead = 0;
+  cfg->ticks = 0.0;
+  cfg->is_lossprob = 0.0;
+  cfg->late_latency = 0.0;
+  cfg->warmup_time = 0.0;
+  cfg->warmup_msgs = 0;
+  cfg->mser = 0;
+  cfg->stop_time = 0.0;
+  cfg->wall_budget = 0.0;
+  cfg->stop_delivered = 0;
+  cfg->stop_precision = 0.0;
+}
+
+struct sim *sim_create(const struct protocol *proto, const struct simconfig *cfg)
+{
+  struct sim *s = xmalloc(sizeof(struct sim));
+
+  s->proto = proto;
+  s->cfg = *cfg;
+  /* calloc(n, 0) may return NULL, so always ask for at least a byte */
+  s->ctx[A] = calloc(1, proto->A_size ? proto->A_size : 1);
+  s->ctx[B] = calloc(1, proto->B_size ? proto->B_size : 1);
+  if (s->ctx[A] == NULL || s->ctx[B] == NULL) {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->host.ops = &simops;
+  s->host.eng = s;
+  s->host.stats = &s->stats;
+  s->started = 0;
+  s->record = NULL;
+  s->evlist = NULL;
+  s->freeevents = NULL;
+  s->nevents = 0;
+  s->accepted = NULL;
+  s->acceptsize = 0;
+  s->batches = NULL;
+  return s;
+}
+
+void sim_record(struct sim *s, FILE *log)
+{
+  struct recheader h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, REC_MAGIC, sizeof(h.magic));
+  strncpy(h.proto, s->proto->name, sizeof(h.proto) - 1);
+  fwrite(&h, sizeof(h), 1, log);
+  s->record = log;
+}
+
+/* log a call into the protocol, with its packet or message */
+static void logcall(struct sim *s, int type, int entity, const struct pkt *packet,
+                    const struct msg *message)
+{
+  struct record r;
+
+  if (s->record == NULL)
+    return;
+  memset(&r, 0, sizeof(r));
+  r.time = totime(s, s->time);
+  r.type = type;
+  r.entity = entity;
+  if (packet != NULL)
+    r.pkt = *packet;
+  if (message != NULL)
+    memcpy(r.pkt.payload, message->data, sizeof(r.pkt.payload));
+  fwrite(&r, sizeof(r), 1, s->record);
+}
+
+/* a greedy sender: hand A messages until it refuses one (see
+   greedy_offer()); no arrival events are needed at all */
+static void feed(struct sim *s)
+{
+  struct msg msg2give;
+  int i;
+
+  while (s->nsim < s->cfg.nsimmax) {
+    if (s->warm && s->cfg.warmup_msgs > 0 && s->nsim >= s->cfg.warmup_msgs)
+      endwarmup(s);
+    for (i=0; i<20; i++)
+      msg2give.data[i] = 97 + s->nsim % 26;
+    logcall(s, REC_OUTPUT, A, NULL, &msg2give);
+    if (!greedy_offer(s->proto, s->ctx[A], msg2give, &s->stats)) {
+      logcall(s, REC_REFUSED, A, NULL, NULL);
+      return;
+    }
+    s->nsim++;
+    accept(s);
+  }
+}
+
+static void init(struct sim *s)                /* initialize the simulator */
+{
+  float sum, avg;
+  int i;
+
+  if (s->cfg.rng == RNG_LIBC) {
+    srand(s->cfg.seed);     /* init random number generator */
+    sum = 0.0;              /* test random number generator for students */
+    for (i=0; i<1000; i++)
+      sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
+    avg = sum/1000.0;
+    if (avg < 0.25 || avg > 0.75) {
+      printf("It is likely that random number generation on your machine\n" ); 
+      printf("is different from what this emulator expects.  Please take\n");
+      printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+      exit(EXIT_FAILURE);
+    }
+    s->nrand = 1000;
+  }
+  for (i=0; i<NSTREAMS; i++) {
+    s->key[i] = rng_key(s->cfg.seed, i);
+    s->block[i].first = UINT64_MAX - RNG_BLOCK;     /* empty */
+  }
+  s->logweight = 0.0;
+  s->narrivals = 0;
+  workload_init(&s->wl);
+  s->ntx[A] = 0;
+  s->ntx[B] = 0;
+  for (i=0; i<2; i++) {
+    s->gapleft[i][GAP_LOSS] = s->gapleft[i][GAP_CORRUPT] = -1;
+    s->ngaps[i] = 0;
+  }
+
+  s->time=totick(s, 0.0);      /* initialize time to 0.0 */
+  s->arrivalpending = 0;
+  s->nstamps = 0;
+
+  /* initialise statistics */
+  resetstats(s);
+  s->accepthead = 0;
+  s->acceptcount = 0;
+  s->nsim = 0;
+  s->warm = s->cfg.warmup_time > 0 || s->cfg.warmup_msgs > 0 || s->cfg.mser;
+  s->batchsum = 0.0;
+  s->batchn = 0;
+  s->nbatches = s->maxbatches = 0;
+  s->nextcheck = MSER_MIN;
+  s->stopreason = STOP_DRAINED;
+  s->convsum = 0.0;
+  s->convn = 0;
+  s->convsize = 10;
+  s->nconv = 0;
+
+  generate_next_arrival(s);    /* initialize event list */
+}
+
+void sim_run(struct sim *s)
+{
+  struct event *eventptr, arrival;
   struct msg  msg2give;
   struct pkt  pkt2give;
-   
+  const struct protocol *p = s->proto;
+  struct host *prevhost = curhost;
   int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
+
+  long nevents = 0;
+
+  curhost = &s->host;
+  s->wallstart = wallclock();
+  if (!s->started) {
+    init(s);
+    logcall(s, REC_INIT, A, NULL, NULL);
+    p->A_init(s->ctx[A]);
+    logcall(s, REC_INIT, B, NULL, NULL);
+    p->B_init(s->ctx[B]);
+    s->started = 1;
+    if (s->cfg.workload == WL_GREEDY)
+      feed(s);
+  }
+  else
+    s->stopreason = STOP_DRAINED;   /* carry on where the run stopped */
+
+  while (s->stopreason == STOP_DRAINED) {
+    eventptr = nextevent(s);      /* get next event to simulate */
     if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
+      break;
+    if (s->cfg.stop_time > 0 && totime(s, eventptr->evtime) > s->cfg.stop_time) {
+      s->time = totick(s, s->cfg.stop_time);
+      s->stopreason = STOP_TIME;
+      break;
+    }
+    if (s->cfg.wall_budget > 0 && ++nevents % WALL_EVERY == 0 &&
+        wallclock() - s->wallstart > s->cfg.wall_budget) {
+      s->stopreason = STOP_WALL;
+      break;
+    }
+    if (eventptr == &s->arrival) {  /* take it out of its slot */
+      arrival = s->arrival;
+      eventptr = &arrival;
+      s->arrivalpending = 0;
+    }
+    else {
+      s->evlist = s->evlist->next;  /* remove this event from event list */
+      if (s->evlist!=NULL)
+        s->evlist->prev=NULL;
+    }
     if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
+      printf("\nEVENT time: %f,",totime(s, eventptr->evtime));
       printf("  type: %d",eventptr->evtype);
       if (eventptr->evtype==0)
         printf(", timerinterrupt  ");
@@ -419,12 +1049,16 @@ int main(void)
         printf(", fromlayer3 ");
       printf(" entity: %d\n",eventptr->eventity);
     }
-    time = eventptr->evtime;        /* update time to next event time */
+    s->time = eventptr->evtime;     /* update time to next event time */
+    if (s->warm && s->cfg.warmup_time > 0 && totime(s, s->time) >= s->cfg.warmup_time)
+      endwarmup(s);
     if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
+      if (s->nsim < s->cfg.nsimmax) {
+        if (s->warm && s->cfg.warmup_msgs > 0 && s->nsim >= s->cfg.warmup_msgs)
+          endwarmup(s);
+        generate_next_arrival(s);  /* set up future arrival */
         /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
+        j = s->nsim % 26; 
         for (i=0; i<20; i++)  
           msg2give.data[i] = 97 + j;
         if (TRACE>2) {
@@ -433,46 +1067,331 @@ int main(void)
             printf("%c", msg2give.data[i]);
           printf("\n");
         }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
+        s->nsim++;
+        logcall(s, REC_OUTPUT, eventptr->eventity, NULL, &msg2give);
+        if (eventptr->eventity == A) {
+          long long dropped = s->stats.window_full;
+          p->A_output(s->ctx[A], msg2give);  
+          if (s->stats.window_full == dropped)
+            accept(s);
+        }
         else
-          B_output(msg2give);  
+          p->B_output(s->ctx[B], msg2give);  
       }
       else if (TRACE > 2)
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
+      pkt2give.seqnum = eventptr->pkt.seqnum;
+      pkt2give.acknum = eventptr->pkt.acknum;
+      pkt2give.checksum = eventptr->pkt.checksum;
       for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+        pkt2give.payload[i] = eventptr->pkt.payload[i];
+      logcall(s, REC_INPUT, eventptr->eventity, &pkt2give, NULL);
+      if (eventptr->eventity ==A)      /* deliver packet by calling */
+        p->A_input(s->ctx[A], pkt2give);  /* appropriate entity */
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        p->B_input(s->ctx[B], pkt2give);
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+      logcall(s, REC_TIMER, eventptr->eventity, NULL, NULL);
       if (eventptr->eventity == A) 
-        A_timerinterrupt();
+        p->A_timerinterrupt(s->ctx[A]);
       else
-        B_timerinterrupt();
+        p->B_timerinterrupt(s->ctx[B]);
     }
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
     }
-    free(eventptr);
+    if (s->cfg.workload == WL_GREEDY && eventptr->eventity == A)
+      feed(s);
+    if (eventptr != &arrival)
+      freeevent(s, eventptr);
+    if (s->cfg.stop_delivered > 0 && s->messages_delivered >= s->cfg.stop_delivered && !s->warm)
+      s->stopreason = STOP_DELIVERED;
   }
+  curhost = prevhost;
+}
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+void sim_result(const struct sim *s, struct simresult *res)
+{
+  res->time = totime(s, s->time);
+  res->starttime = totime(s, s->starttime);
+  res->warm = s->warm;
+  res->stopreason = s->stopreason;
+  res->nsim = s->nsim;
+  res->messages_delivered = s->messages_delivered;
+  res->ntolayer3 = s->ntolayer3;
+  res->nlost = s->nlost;
+  res->ncorrupt = s->ncorrupt;
+  res->stats = s->stats;
+  res->latency_avg = s->latency_n ? s->latency_sum / s->latency_n : 0.0;
+  res->latency_max = s->latency_max;
+  res->nlate = s->nlate;
+  res->weight = exp(s->logweight);
+  res->memory = sizeof(struct sim) + s->proto->A_size + s->proto->B_size +
+    s->nevents * sizeof(struct event) + s->acceptsize * sizeof(simtime) +
+    s->maxbatches * sizeof(double);
+}
+
+const char *stopreasons[] = {
+  "no events left", "simulated time limit reached", "wall-clock budget used up",
+  "enough messages delivered", "mean latency converged"
+};
+
+void sim_report(const struct sim *s)
+{
+  printf(" Simulator terminated at time %f\n after attempting to send %lld msgs from layer5\n",totime(s, s->time),s->nsim);
+  if (s->stopreason != STOP_DRAINED)
+    printf("stopped early: %s\n", stopreasons[s->stopreason]);
+  if (s->cfg.warmup_time > 0 || s->cfg.warmup_msgs > 0 || s->cfg.mser) {
+    if (s->warm)
+      printf("warm-up never ended: statistics cover the whole run\n");
+    else
+      printf("warm-up deleted: statistics cover time %f to %f\n", totime(s, s->starttime),
+             totime(s, s->time));
+  }
+  printf("number of messages dropped due to full window:  %lld \n", s->stats.window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %lld \n", s->stats.new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  printf("number of packet resends by A:  %lld \n", s->stats.packets_resent);
+  printf("number of correct packets received at B:  %lld \n", s->stats.packets_received);
+  printf("number of messages delivered to application:  %lld \n", s->messages_delivered);
+}
+
+void sim_destroy(struct sim *s)
+{
+  struct event *q;
+
+  while ((q = s->evlist) != NULL) {
+    s->evlist = q->next;
+    free(q);
+  }
+  while ((q = s->freeevents) != NULL) {
+    s->freeevents = q->next;
+    free(q);
+  }
+  free(s->ctx[A]);
+  free(s->ctx[B]);
+  free(s->accepted);
+  free(s->batches);
+  free(s);
+}
+
+/********************** CHECKPOINTS ***********************/
+
+/* A snapshot is the struct sim itself, followed by what its pointers
+   lead to: the protocol contexts, the pending events in list order,
+   the acceptance times of the messages in flight and the warm-up
+   batches.  The pointers in the copy mean nothing and are set again
+   when it is read.  The state of rand() cannot be read out, so it is
+   restored by calling rand() as often as the run had.  A snapshot is
+   for the build that wrote it, which the sizes in the header check. */
+
+#define SNAP_MAGIC "rtsnap1"
+
+struct snapheader {
+  char magic[8];
+  char proto[32];               /* name of the protocol */
+  uint64_t simsize, eventsize;
+  uint64_t A_size, B_size;
+  uint64_t nevents;             /* events in the list */
+};
+
+int sim_save(const struct sim *s, FILE *f)
+{
+  struct snapheader h;
+  const struct event *q;
+  int i;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+  strncpy(h.proto, s->proto->name, sizeof(h.proto) - 1);
+  h.simsize = sizeof(struct sim);
+  h.eventsize = sizeof(struct event);
+  h.A_size = s->proto->A_size;
+  h.B_size = s->proto->B_size;
+  for (q = s->evlist; q != NULL; q = q->next)
+    h.nevents++;
+
+  if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(s, sizeof(struct sim), 1, f) != 1 ||
+      fwrite(s->ctx[A], 1, h.A_size, f) != h.A_size ||
+      fwrite(s->ctx[B], 1, h.B_size, f) != h.B_size)
+    return -1;
+  for (q = s->evlist; q != NULL; q = q->next)
+    if (fwrite(q, sizeof(struct event), 1, f) != 1)
+      return -1;
+  for (i = 0; i < s->acceptcount; i++)
+    if (fwrite(&s->accepted[(s->accepthead + i) % s->acceptsize], sizeof(simtime), 1, f) != 1)
+      return -1;
+  if (fwrite(s->batches, sizeof(double), s->nbatches, f) != (size_t)s->nbatches)
+    return -1;
+  return fflush(f) == 0 ? 0 : -1;
+}
+
+struct sim *sim_load(const struct protocol *proto, FILE *f)
+{
+  struct snapheader h;
+  struct sim *s;
+  struct event *q, *last = NULL;
+  uint64_t n;
+
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) != 0) {
+    printf("not a simulation snapshot\n");
+    return NULL;
+  }
+  if (strncmp(h.proto, proto->name, sizeof(h.proto)) != 0 ||
+      h.A_size != proto->A_size || h.B_size != proto->B_size) {
+    printf("the snapshot is of protocol %.31s, not %s\n", h.proto, proto->name);
+    return NULL;
+  }
+  if (h.simsize != sizeof(struct sim) || h.eventsize != sizeof(struct event)) {
+    printf("the snapshot was written by another build of the simulator\n");
+    return NULL;
+  }
+
+  s = xmalloc(sizeof(struct sim));
+  if (fread(s, sizeof(struct sim), 1, f) != 1) {
+    free(s);
+    printf("the snapshot is truncated\n");
+    return NULL;
+  }
+  s->proto = proto;
+  s->host.ops = &simops;
+  s->host.eng = s;
+  s->host.stats = &s->stats;
+  s->cfg.trace = NULL;          /* not saved */
+  s->cfg.ntrace = 0;
+  s->record = NULL;
+  s->evlist = NULL;
+  s->freeevents = NULL;
+  s->nevents = 0;
+  s->ctx[A] = calloc(1, proto->A_size ? proto->A_size : 1);
+  s->ctx[B] = calloc(1, proto->B_size ? proto->B_size : 1);
+  s->accepted = s->acceptsize ? malloc(s->acceptsize * sizeof(simtime)) : NULL;
+  s->batches = s->maxbatches ? malloc(s->maxbatches * sizeof(double)) : NULL;
+  if (s->ctx[A] == NULL || s->ctx[B] == NULL || (s->acceptsize && s->accepted == NULL) ||
+      (s->maxbatches && s->batches == NULL)) {
+    printf("memory allocation for the restored simulation failed.");
+    exit(EXIT_FAILURE);
+  }
+
+  if (fread(s->ctx[A], 1, h.A_size, f) != h.A_size ||
+      fread(s->ctx[B], 1, h.B_size, f) != h.B_size)
+    goto truncated;
+  for (n = 0; n < h.nevents; n++) {
+    q = newevent(s);
+    if (fread(q, sizeof(struct event), 1, f) != 1) {
+      freeevent(s, q);
+      goto truncated;
+    }
+    q->prev = last;
+    q->next = NULL;
+    if (last == NULL)
+      s->evlist = q;
+    else
+      last->next = q;
+    last = q;
+  }
+  s->accepthead = 0;
+  if (fread(s->accepted, sizeof(simtime), s->acceptcount, f) != (size_t)s->acceptcount ||
+      fread(s->batches, sizeof(double), s->nbatches, f) != (size_t)s->nbatches)
+    goto truncated;
+
+  if (s->started && s->cfg.rng == RNG_LIBC) {
+    srand(s->cfg.seed);
+    for (n = 0; n < s->nrand; n++)
+      rand();
+  }
+  return s;
+
+ truncated:
+  printf("the snapshot is truncated\n");
+  sim_destroy(s);
+  return NULL;
+}
+
+/* The state of a simulation is a few kilobytes, so a fork copies all
+   of it: cheaper than tracking what is shared, and the copies can then
+   run on any threads. */
+struct sim *sim_fork(const struct sim *s)
+{
+  struct sim *c = xmalloc(sizeof(struct sim));
+  const struct event *q;
+  struct event *e, *last = NULL;
+
+  *c = *s;
+  c->host.eng = c;
+  c->host.stats = &c->stats;
+  c->record = NULL;
+  c->ctx[A] = xmalloc(s->proto->A_size ? s->proto->A_size : 1);
+  c->ctx[B] = xmalloc(s->proto->B_size ? s->proto->B_size : 1);
+  memcpy(c->ctx[A], s->ctx[A], s->proto->A_size);
+  memcpy(c->ctx[B], s->ctx[B], s->proto->B_size);
+  c->evlist = NULL;
+  c->freeevents = NULL;
+  c->nevents = 0;
+  for (q = s->evlist; q != NULL; q = q->next) {
+    e = newevent(c);
+    *e = *q;
+    e->prev = last;
+    e->next = NULL;
+    if (last == NULL)
+      c->evlist = e;
+    else
+      last->next = e;
+    last = e;
+  }
+  c->accepted = NULL;
+  if (s->acceptsize) {
+    c->accepted = xmalloc(s->acceptsize * sizeof(simtime));
+    memcpy(c->accepted, s->accepted, s->acceptsize * sizeof(simtime));
+  }
+  c->batches = NULL;
+  if (s->maxbatches) {
+    c->batches = xmalloc(s->maxbatches * sizeof(double));
+    memcpy(c->batches, s->batches, s->nbatches * sizeof(double));
+  }
+  return c;
+}
+
+void sim_endwarmup(struct sim *s)
+{
+  endwarmup(s);
+}
+
+void sim_getconfig(const struct sim *s, struct simconfig *cfg)
+{
+  *cfg = s->cfg;
+}
+
+/* Between runs any parameter can change except the generator and the
+   clock resolution, which the state already depends on.  A new seed
+   starts new streams from here on, and skip-ahead gaps drawn for the
+   old probabilities are drawn again: the gaps are memoryless, so the
+   packets still meet their fates with the new probabilities. */
+void sim_setconfig(struct sim *s, const struct simconfig *cfg)
+{
+  struct simconfig old = s->cfg;
+  int i;
+
+  s->cfg = *cfg;
+  if (!s->started)
+    return;
+  s->cfg.rng = old.rng;
+  s->cfg.ticks = old.ticks;
+  if (cfg->seed != old.seed) {
+    if (s->cfg.rng == RNG_LIBC) {
+      srand(cfg->seed);
+      s->nrand = 0;
+    }
+    for (i=0; i<NSTREAMS; i++) {
+      s->key[i] = rng_key(cfg->seed, i);
+      s->block[i].first = UINT64_MAX - RNG_BLOCK;     /* empty */
+    }
+  }
+  if (cfg->seed != old.seed || cfg->lossprob != old.lossprob ||
+      cfg->corruptprob != old.corruptprob || cfg->is_lossprob != old.is_lossprob)
+    for (i=0; i<2; i++)
+      s->gapleft[i][GAP_LOSS] = s->gapleft[i][GAP_CORRUPT] = -1;
+}
@@ -1,11 +1,11 @@
-extern int TRACE;
+#ifndef EMULATOR_H
+#define EMULATOR_H
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+extern int TRACE;          /* 0 and up: more detail; -1: not even warnings */
 
 #define   A    0
 #define   B    1
@@ -27,14 +27,219 @@ struct pkt {
   char payload[20];
 };
 
+/* statistics updated by the protocol, kept separately for each simulation */
+struct protostats {
+  long long total_ACKs_received;
+  long long packets_resent;       /* count of the number of packets resent  */
+  long long new_ACKs;             /* count of the number of acks correctly received */
+  long long packets_received;     /* count of the packets received by receiver */
+  long long window_full;          /* count of the number of messages dropped due to full window */
+};
+
 /* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
+extern void tolayer3(int, struct pkt);
 
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(int, char[20]);
 
 /* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
+extern void starttimer(int, double);
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(int);
+
+/* included for extension to bidirectional communication */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+
+/* A protocol is a table of the entity routines.  Each entity owns a
+   block of state (A_size or B_size bytes, zeroed) which the simulator
+   allocates and passes to every call, so any number of instances of any
+   number of protocols can live in one program. */
+struct protocol {
+  const char *name;
+  size_t A_size;            /* bytes of sender state */
+  size_t B_size;            /* bytes of receiver state */
+  void (*A_init)(void *ctx);
+  void (*A_output)(void *ctx, struct msg message);
+  void (*A_input)(void *ctx, struct pkt packet);
+  void (*A_timerinterrupt)(void *ctx);
+  void (*B_init)(void *ctx);
+  void (*B_output)(void *ctx, struct msg message);
+  void (*B_input)(void *ctx, struct pkt packet);
+  void (*B_timerinterrupt)(void *ctx);
+};
+
+/* The engine running a protocol entity.  tolayer3() and the other
+   student-callable routines forward to the host of the entity whose
+   routine is currently executing on this thread. */
+struct hostops {
+  void (*tolayer3)(void *eng, int AorB, struct pkt packet);
+  void (*tolayer5)(void *eng, int AorB, char datasent[20]);
+  void (*starttimer)(void *eng, int AorB, double increment);
+  void (*stoptimer)(void *eng, int AorB);
+};
+
+struct host {
+  const struct hostops *ops;
+  void *eng;
+  struct protostats *stats;
+};
+
+extern _Thread_local struct host *curhost;
+
+/* statistics of the simulation the calling protocol entity belongs to */
+static inline struct protostats *stats(void)
+{
+  return curhost->stats;
+}
+
+/********************* the simulator ****************************************/
+
+/* Network and workload parameters of one simulation run.  Message and
+   packet counts here and in the results are 64-bit, and the simulator
+   keeps no per-message state beyond the messages in flight, so a run
+   of 10^10 messages needs no more memory than one of a thousand. */
+struct simconfig {
+  long long nsimmax;        /* number of msgs to generate, then stop */
+  float lossprob;           /* probability that a packet is dropped  */
+  float corruptprob;        /* probability that one bit is packet is flipped */
+  int corruptdirection;     /* A->B A<-B or bidirectional corruption/loss */
+  float lambda;             /* arrival rate of messages from layer 5 */
+  /* how messages arrive from layer 5, see workload.h */
+  int workload;             /* WL_UNIFORM (the original), WL_POISSON... */
+  float burst_on, burst_off;  /* WL_ONOFF: mean burst and silence lengths */
+  float pareto_shape;       /* WL_PARETO: tail index of the object sizes */
+  const double *trace;      /* WL_TRACE: arrival times, ascending */
+  long long ntrace;
+  unsigned seed;            /* random number generator seed */
+  int rng;                  /* RNG_LIBC or RNG_KEYED, see below */
+  double ticks;             /* clock resolution in ticks per time unit,
+                               kept in 64 bits; 0 keeps the original float
+                               clock, which loses sub-unit precision after
+                               about 10^7 time units */
+  int skipahead;            /* draw the number of packets until the next
+                               loss or corruption instead of deciding
+                               every packet: the same distribution with
+                               far fewer draws when they are rare */
+
+  /* Importance sampling: packets are lost with probability is_lossprob
+     instead of lossprob (0: off), and the result carries the likelihood
+     ratio of the run, by which measures are weighted to estimate them
+     under lossprob.  late_latency is the delivery latency above which a
+     message counts as late, the kind of rare outcome this is for. */
+  float is_lossprob;
+  float late_latency;
+
+  /* Warm-up deletion: statistics are reset when simulated time reaches
+     warmup_time, when warmup_msgs messages have been generated, or (with
+     mser set) when MSER-5 on the delivery latencies finds the initial
+     transient over, whichever happens first.  0 disables each. */
+  float warmup_time;
+  long long warmup_msgs;
+  int mser;
+
+  /* Stop conditions, checked between events; 0 disables each.  Without
+     any the run ends when no events are left, which with retransmission
+     storms can be long after the last message. */
+  float stop_time;          /* simulated time */
+  double wall_budget;       /* seconds of wall-clock time */
+  long long stop_delivered; /* messages delivered (after the warm-up) */
+  double stop_precision;    /* 95% confidence interval of the mean latency
+                               within this fraction of it (batch means) */
+};
+
+/* why a run ended */
+#define STOP_DRAINED    0
+#define STOP_TIME       1
+#define STOP_WALL       2
+#define STOP_DELIVERED  3
+#define STOP_CONVERGED  4
+
+extern const char *stopreasons[];
+
+/* RNG_LIBC draws from rand() in call order, as the original emulator
+   did.  RNG_KEYED keys every draw on what it is for: the n-th arrival,
+   or the n-th packet sent in a direction.  Two runs with the same seed
+   then see the same channel whatever the protocols do (common random
+   numbers).  Keyed runs also share no state, so they may run
+   concurrently on several threads. */
+#define RNG_LIBC  0
+#define RNG_KEYED 1
+
+/* what a finished (or stopped) run has measured */
+struct simresult {
+  double time;              /* simulated time at the end of the run */
+  double starttime;         /* time the statistics were collected from */
+  int warm;                 /* the warm-up period never ended */
+  int stopreason;           /* STOP_... */
+  long long nsim;           /* messages passed from layer 5 to 4 */
+  long long messages_delivered;  /* messages delivered to layer 5 at the receiver */
+  long long ntolayer3;      /* packets sent into layer 3 */
+  long long nlost;          /* packets lost in the medium */
+  long long ncorrupt;       /* packets corrupted by the medium */
+  double latency_avg;       /* mean time from acceptance by A to delivery at B */
+  float latency_max;
+  long long nlate;          /* messages delivered later than late_latency */
+  double weight;            /* likelihood ratio (1 without importance sampling) */
+  size_t memory;            /* most bytes held for events and statistics */
+  struct protostats stats;
+};
+
+struct sim;
+
+extern void simconfig_default(struct simconfig *cfg);
+extern struct sim *sim_create(const struct protocol *proto, const struct simconfig *cfg);
+extern void sim_run(struct sim *s);
+extern void sim_result(const struct sim *s, struct simresult *res);
+extern void sim_report(const struct sim *s);
+extern void sim_destroy(struct sim *s);
+extern void printevlist(const struct sim *s);
+
+/* Checkpoints.  sim_save() writes the whole state of a simulation, run
+   or stopped part way by a stop condition, to f (0 on success);
+   sim_load() reads it back for the same protocol, or says why it cannot
+   and returns NULL.  sim_run() on the restored simulation carries on
+   exactly as the original would have, as it does when called again on
+   a stopped one.  The arrival times of a trace workload are not in the
+   snapshot: set them again with sim_setconfig().  sim_setconfig()
+   changes the parameters before the run goes on (stop conditions,
+   network, seed); the generator and the clock resolution stay as the
+   run began. */
+extern int sim_save(const struct sim *s, FILE *f);
+extern struct sim *sim_load(const struct protocol *proto, FILE *f);
+extern void sim_getconfig(const struct sim *s, struct simconfig *cfg);
+extern void sim_setconfig(struct sim *s, const struct simconfig *cfg);
+
+/* Log every call the simulation makes into the protocol to 'log' (see
+   replay.h), from the start of the run; call before sim_run(). */
+extern void sim_record(struct sim *s, FILE *log);
+
+/* sim_fork() makes an independent copy of a simulation, to run on from
+   where it stopped; with keyed random numbers the copies can run on
+   different threads, while with rand() they share its one sequence.
+   sim_endwarmup() ends the warm-up now: the statistics start again. */
+extern struct sim *sim_fork(const struct sim *s);
+extern void sim_endwarmup(struct sim *s);
+
+#define CHANNEL_LOST (-1.0)
+#define CHANNEL_DRAWS 4         /* uniforms drawn per packet: */
+#define DRAW_LOSS       0       /* whether it is lost */
+#define DRAW_DELAY      1       /* its delay */
+#define DRAW_CORRUPT    2       /* whether it is corrupted */
+#define DRAW_CORRUPTION 3       /* and which field */
+extern double channel_decide(const struct simconfig *cfg, int AorB,
+                             const double u[CHANNEL_DRAWS], struct pkt *packet,
+                             int *corrupted);
+extern double channel_fate(const struct simconfig *cfg, uint64_t key, uint64_t tx,
+                           int AorB, struct pkt *packet, int *corrupted);
+
+/* A greedy sender (WL_GREEDY) always has data: after every event at A,
+   when its window may have opened, the engine hands A messages until
+   it refuses one.  greedy_offer() hands message m to A (context ctx,
+   counting into stats) and returns 1 if A took it.  A refusal is taken
+   back out of stats->window_full: the message is not lost but offered
+   again next time, so it does not count as dropped. */
+extern int greedy_offer(const struct protocol *proto, void *ctx, struct msg m,
+                        struct protostats *stats);
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "stats.h"
+#include "experiment.h"
+
+/* ******************************************************************
+   Experiments made of many simulation runs: protocol comparisons with
+   common random numbers, independent replications run in parallel
+   until their confidence intervals are narrow enough, and what-if
+   continuations of one simulation under changed parameters.
+**********************************************************************/
+
+#define LEVEL 0.95              /* confidence level of reported intervals */
+
+const char *measure_names[NMEASURES] = {
+  "throughput", "latency", "resent", "delivered", "window full", "end time",
+  "late", "weight"
+};
+
+void measures(const struct simresult *res, double m[NMEASURES])
+{
+  double span = res->time - res->starttime;
+
+  m[M_THROUGHPUT] = span > 0 ? res->messages_delivered / span : 0.0;
+  m[M_LATENCY] = res->latency_avg;
+  m[M_DELIVERED] = res->messages_delivered;
+  m[M_RESENT] = res->stats.packets_resent;
+  m[M_DROPPED] = res->stats.window_full;
+  m[M_TIME] = res->time;
+  m[M_LATE] = res->nlate > 0;
+  m[M_WEIGHT] = res->weight;
+}
+
+/* run one simulation to the end and take its measures */
+static void runone(const struct protocol *proto, const struct simconfig *cfg,
+                   double m[NMEASURES])
+{
+  struct simresult res;
+  struct sim *s;
+
+  s = sim_create(proto, cfg);
+  sim_run(s);
+  sim_result(s, &res);
+  sim_destroy(s);
+  measures(&res, m);
+}
+
+void compare_protocols(const struct protocol *p, const struct protocol *q,
+                       const struct simconfig *cfg, int replications)
+{
+  struct summary sp[NMEASURES], sq[NMEASURES], sd[NMEASURES];
+  struct simconfig c = *cfg;
+  double mp[NMEASURES], mq[NMEASURES];
+  int r, i;
+
+  for (i = 0; i < NMEASURES; i++) {
+    summary_init(&sp[i]);
+    summary_init(&sq[i]);
+    summary_init(&sd[i]);
+  }
+
+  c.rng = RNG_KEYED;
+  for (r = 0; r < replications; r++) {
+    c.seed = cfg->seed + r;
+    runone(p, &c, mp);
+    runone(q, &c, mq);
+    for (i = 0; i < NMEASURES; i++) {
+      summary_add(&sp[i], mp[i]);
+      summary_add(&sq[i], mq[i]);
+      summary_add(&sd[i], mp[i] - mq[i]);
+    }
+  }
+
+  printf("%s vs %s over %d replications with common random numbers (seeds %u..%u)\n",
+         p->name, q->name, replications, cfg->seed, cfg->seed + replications - 1);
+  printf("%-12s %12s %12s %12s %12s %12s %9s\n", "measure", p->name, q->name,
+         "difference", "+/- paired", "+/- indep.", "var. red.");
+  for (i = 0; i < NMEASURES; i++) {
+    double paired = summary_halfwidth(&sd[i], LEVEL);
+    /* the interval independent runs of the same size would give */
+    double vp = summary_sd(&sp[i]), vq = summary_sd(&sq[i]);
+    double indep = t_quantile(1.0 - (1.0 - LEVEL) / 2.0, 2 * (replications - 1))
+      * sqrt((vp * vp + vq * vq) / replications);
+
+    printf("%-12s %12.6g %12.6g %12.6g %12.6g %12.6g", measure_names[i],
+           sp[i].mean, sq[i].mean, sd[i].mean, paired, indep);
+    if (paired > 0.0 && isfinite(paired))
+      printf(" %9.3g\n", (indep * indep) / (paired * paired));
+    else
+      printf(" %9s\n", "-");
+  }
+  printf("(+/- are half-widths of %.0f%% confidence intervals for the difference;\n"
+         " var. red. is how many times fewer runs the pairing needs)\n", 100 * LEVEL);
+}
+
+/********************* independent replications ************************/
+
+#define MINREPS 5               /* replications before judging precision */
+
+struct worker {
+  const struct protocol *proto;
+  const struct simconfig *cfg;
+  double (*m)[NMEASURES];       /* measures of every replication */
+  int first, last, stride;      /* replications this worker runs */
+};
+
+static void *work(void *arg)
+{
+  struct worker *w = arg;
+  struct simconfig c = *w->cfg;
+  int r;
+
+  for (r = w->first; r < w->last; r += w->stride) {
+    c.seed = w->cfg->seed + r;
+    runone(w->proto, &c, w->m[r]);
+  }
+  return NULL;
+}
+
+/* run replications [first, last) on up to 'threads' threads */
+static void runbatch(const struct protocol *p, const struct simconfig *cfg,
+                     double (*m)[NMEASURES], int first, int last, int threads)
+{
+  pthread_t tid[threads];
+  struct worker w[threads];
+  int t;
+
+  if (threads > last - first)
+    threads = last - first;
+  for (t = 0; t < threads; t++) {
+    w[t].proto = p;
+    w[t].cfg = cfg;
+    w[t].m = m;
+    w[t].first = first + t;
+    w[t].last = last;
+    w[t].stride = threads;
+    if (t > 0 && pthread_create(&tid[t], NULL, work, &w[t]) != 0) {
+      printf("cannot start replication thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  work(&w[0]);                  /* this thread does a share too */
+  for (t = 1; t < threads; t++)
+    pthread_join(tid[t], NULL);
+}
+
+/* are throughput, latency and resends (or under importance sampling,
+   the probability of lateness) all known to within target? */
+static int precise(const struct summary *s, double target, int weighted)
+{
+  static const int judged[] = { M_THROUGHPUT, M_LATENCY, M_RESENT };
+  static const int judged_is[] = { M_LATE };
+  const int *j = weighted ? judged_is : judged;
+  size_t i, n = weighted ? 1 : sizeof(judged) / sizeof(judged[0]);
+
+  for (i = 0; i < n; i++) {
+    const struct summary *x = &s[j[i]];
+    if (summary_halfwidth(x, LEVEL) > target * fabs(x->mean))
+      return 0;
+  }
+  return 1;
+}
+
+int replicate(const struct protocol *p, const struct simconfig *cfg,
+              int maxreps, int threads, double target)
+{
+  struct summary s[NMEASURES];
+  struct simconfig c = *cfg;
+  double (*m)[NMEASURES];
+  double sumw = 0.0, sumw2 = 0.0, w;
+  int weighted = cfg->is_lossprob > 0;
+  int done = 0, next, r, i;
+
+  m = malloc(maxreps * sizeof(*m));
+  if (m == NULL) {
+    printf("memory allocation for replications failed\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < NMEASURES; i++)
+    summary_init(&s[i]);
+  if (threads < 1)
+    threads = 1;
+  c.rng = RNG_KEYED;              /* rand() cannot be shared by threads */
+
+  /* Run in rounds of one replication per thread, and check the
+     precision between rounds, so where the run stops depends only on
+     the seeds and never on thread timing. */
+  while (done < maxreps) {
+    next = done + threads;
+    if (done == 0 && next < MINREPS)
+      next = MINREPS;
+    if (next > maxreps)
+      next = maxreps;
+    runbatch(p, &c, m, done, next, threads);
+    for (r = done; r < next; r++) {
+      w = m[r][M_WEIGHT];
+      sumw += w;
+      sumw2 += w * w;
+      for (i = 0; i < NMEASURES; i++)
+        summary_add(&s[i], i != M_WEIGHT && weighted ? w * m[r][i] : m[r][i]);
+    }
+    done = next;
+    if (target > 0 && precise(s, target, weighted))
+      break;
+  }
+
+  printf("%s: %d replications (seeds %u..%u)%s\n", p->name, done, cfg->seed,
+         cfg->seed + done - 1,
+         target > 0 ? (precise(s, target, weighted) ? ", precision target met" :
+                       ", precision target NOT met") : "");
+  if (weighted)
+    printf("importance sampling: loss probability %g in place of %g, measures weighted;\n"
+           " effective sample size %.1f, mean weight should be near 1\n",
+           cfg->is_lossprob, cfg->lossprob, sumw2 > 0 ? sumw * sumw / sumw2 : 0.0);
+  printf("%-12s %12s %12s %12s %12s %9s\n", "measure", "mean", "std dev",
+         "95% CI low", "95% CI high", "+/- %");
+  for (i = 0; i < NMEASURES; i++) {
+    double hw = summary_halfwidth(&s[i], LEVEL);
+    printf("%-12s %12.6g %12.6g %12.6g %12.6g", measure_names[i], s[i].mean,
+           summary_sd(&s[i]), s[i].mean - hw, s[i].mean + hw);
+    if (s[i].mean != 0.0 && isfinite(hw))
+      printf(" %9.3g\n", 100 * hw / fabs(s[i].mean));
+    else
+      printf(" %9s\n", "-");
+  }
+  free(m);
+  return done;
+}
+
+/********************* what-if continuations ****************************/
+
+int setparam(struct simconfig *cfg, const char *name, double value)
+{
+  if (strcmp(name, "loss") == 0)
+    cfg->lossprob = value;
+  else if (strcmp(name, "corrupt") == 0)
+    cfg->corruptprob = value;
+  else if (strcmp(name, "lambda") == 0)
+    cfg->lambda = value;
+  else if (strcmp(name, "seed") == 0)
+    cfg->seed = value;
+  else
+    return 0;
+  return 1;
+}
+
+struct forker {
+  const struct sim *base;
+  const struct simconfig *cfgs;  /* of every continuation */
+  double (*m)[NMEASURES];
+  int first, last, stride;      /* continuations this worker runs */
+};
+
+/* Every worker forks the shared base, which none of them changes, and
+   the continuations depend only on it and their own parameters, so the
+   results do not depend on the threads. */
+static void *forkwork(void *arg)
+{
+  struct forker *w = arg;
+  struct simresult res;
+  struct sim *s;
+  int r;
+
+  for (r = w->first; r < w->last; r += w->stride) {
+    s = sim_fork(w->base);
+    sim_setconfig(s, &w->cfgs[r]);
+    sim_endwarmup(s);
+    sim_run(s);
+    sim_result(s, &res);
+    sim_destroy(s);
+    measures(&res, w->m[r]);
+  }
+  return NULL;
+}
+
+static void runforks(const struct sim *base, const struct simconfig *cfgs,
+                     double (*m)[NMEASURES], int n, int threads)
+{
+  pthread_t tid[threads];
+  struct forker w[threads];
+  int t;
+
+  for (t = 0; t < threads; t++) {
+    w[t].base = base;
+    w[t].cfgs = cfgs;
+    w[t].m = m;
+    w[t].first = t;
+    w[t].last = n;
+    w[t].stride = threads;
+    if (t > 0 && pthread_create(&tid[t], NULL, forkwork, &w[t]) != 0) {
+      printf("cannot start continuation thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  forkwork(&w[0]);              /* this thread does a share too */
+  for (t = 1; t < threads; t++)
+    pthread_join(tid[t], NULL);
+}
+
+void whatif(const struct sim *base, const struct simconfig *cfg, const char *param,
+            const double *values, int n, int threads)
+{
+  static const int shown[] = { M_THROUGHPUT, M_LATENCY, M_RESENT, M_DELIVERED, M_TIME };
+  struct simconfig *cfgs, start;
+  struct simresult now;
+  double (*m)[NMEASURES];
+  int r, i;
+
+  sim_getconfig(base, &start);
+  sim_result(base, &now);
+  if (start.rng != RNG_KEYED) {
+    printf("what-if continuations need keyed random numbers (-k)\n");
+    exit(EXIT_FAILURE);
+  }
+  cfgs = malloc(n * sizeof(*cfgs));
+  m = malloc(n * sizeof(*m));
+  if (cfgs == NULL || m == NULL) {
+    printf("memory allocation for continuations failed\n");
+    exit(EXIT_FAILURE);
+  }
+  for (r = 0; r < n; r++) {
+    cfgs[r] = *cfg;
+    setparam(&cfgs[r], param, values[r]);
+  }
+  if (threads > n)
+    threads = n;
+  if (threads < 1)
+    threads = 1;
+  runforks(base, cfgs, m, n, threads);
+
+  printf("%d continuations from time %f, varying %s\n", n, now.time, param);
+  printf("%-12s", param);
+  for (i = 0; i < (int)(sizeof(shown) / sizeof(shown[0])); i++)
+    printf(" %12s", measure_names[shown[i]]);
+  printf("\n");
+  for (r = 0; r < n; r++) {
+    printf("%-12g", values[r]);
+    for (i = 0; i < (int)(sizeof(shown) / sizeof(shown[0])); i++)
+      printf(" %12.6g", m[r][shown[i]]);
+    printf("\n");
+  }
+  free(cfgs);
+  free(m);
+}
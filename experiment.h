@@ -0,0 +1,56 @@
+#ifndef EXPERIMENT_H
+#define EXPERIMENT_H
+
+/* ******************************************************************
+   Experiments made of many simulation runs.
+**********************************************************************/
+
+/* the per-run measures that experiments summarise */
+#define M_THROUGHPUT 0          /* messages delivered per time unit */
+#define M_LATENCY    1          /* mean time from acceptance to delivery */
+#define M_RESENT     2          /* packets resent by A */
+#define M_DELIVERED  3          /* messages delivered to layer 5 */
+#define M_DROPPED    4          /* messages dropped because the window was full */
+#define M_TIME       5          /* simulated time at the end of the run */
+#define M_LATE       6          /* 1 if some message was late, else 0 */
+#define M_WEIGHT     7          /* likelihood ratio of the run */
+#define NMEASURES    8
+
+extern const char *measure_names[NMEASURES];
+extern void measures(const struct simresult *res, double m[NMEASURES]);
+
+/* Run protocols p and q 'replications' times each over the same channel
+   realisations (keyed random numbers, seeds cfg->seed, cfg->seed+1...)
+   and print the paired differences p - q with confidence intervals. */
+extern void compare_protocols(const struct protocol *p, const struct protocol *q,
+                              const struct simconfig *cfg, int replications);
+
+/* Run up to 'maxreps' independent replications (keyed random numbers,
+   seeds cfg->seed, cfg->seed+1...) on 'threads' threads and print the
+   mean, standard deviation and confidence interval of each measure.
+   With target > 0, stop as soon as the confidence intervals of
+   throughput, latency and resends are all narrower than target times
+   their mean (e.g. 0.01 for +/-1%).  Returns the replications run.
+
+   Under importance sampling (cfg->is_lossprob > 0) every measure but
+   the weight itself is multiplied by the run's likelihood ratio, so the
+   means estimate the measures under cfg->lossprob; the mean of "late"
+   is then the probability that some message is late, and the precision
+   target applies to it alone. */
+extern int replicate(const struct protocol *p, const struct simconfig *cfg,
+                     int maxreps, int threads, double target);
+
+/* Set the parameter called 'name' of cfg to 'value': loss, corrupt,
+   lambda or seed.  Returns 0 if there is no such parameter. */
+extern int setparam(struct simconfig *cfg, const char *name, double value);
+
+/* What-if analysis: continue the simulation 'base', stopped part way
+   (typically restored from a snapshot taken after its warm-up), once
+   for each of the n values of parameter 'param' with cfg otherwise, on
+   'threads' threads, and print the measures of each continuation,
+   counted from the fork on.  Needs keyed random numbers; base itself
+   is not changed. */
+extern void whatif(const struct sim *base, const struct simconfig *cfg, const char *param,
+                   const double *values, int n, int threads);
+
+#endif
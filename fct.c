@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "rng.h"
+#include "flows.h"
+#include "fct.h"
+
+/* ******************************************************************
+   Flow completion times.  The flows run on the multi-flow engines as
+   finite transfers (flows_setsizes()); this file draws their sizes and
+   start times and summarises how long they took.  The ideal a flow is
+   measured against is the same flow, with the same channel delays,
+   over a channel that loses and corrupts nothing: the slowdown is then
+   what loss and corruption cost the protocol, not the time the channel
+   needs to carry the messages at all.
+**********************************************************************/
+
+#define FCT_STREAM 0xfc70000000000000ULL  /* clear of the flows' streams */
+
+static void *xmalloc(size_t size)
+{
+  void *p = malloc(size ? size : 1);
+
+  if (p == NULL) {
+    printf("memory allocation for flow completion times failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static int loadcdf(struct fctsizes *sz, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  double x, p;
+  int size = 0;
+
+  if (f == NULL) {
+    printf("cannot open flow size distribution %s\n", path);
+    return 0;
+  }
+  sz->ncdf = 0;
+  while (fscanf(f, "%lf %lf", &x, &p) == 2) {
+    if (x < 1 || p < 0 || p > 1 ||
+        (sz->ncdf > 0 && (x <= sz->cdfsize[sz->ncdf - 1] || p < sz->cdfprob[sz->ncdf - 1])))
+      break;
+    if (sz->ncdf == size) {
+      size = size ? 2 * size : 64;
+      sz->cdfsize = realloc(sz->cdfsize, size * sizeof(double));
+      sz->cdfprob = realloc(sz->cdfprob, size * sizeof(double));
+      if (sz->cdfsize == NULL || sz->cdfprob == NULL) {
+        printf("memory allocation for the flow size distribution failed.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    sz->cdfsize[sz->ncdf] = x;
+    sz->cdfprob[sz->ncdf++] = p;
+  }
+  if (!feof(f) || sz->ncdf == 0) {
+    printf("flow size distribution %s: expected ascending sizes (from 1) and "
+           "probabilities after %d lines\n", path, sz->ncdf);
+    fclose(f);
+    fct_free(sz);
+    return 0;
+  }
+  fclose(f);
+  return 1;
+}
+
+int fct_parse(struct fctsizes *sz, const char *spec)
+{
+  memset(sz, 0, sizeof(*sz));
+  if (sscanf(spec, "fixed:%lf", &sz->a) == 1 && sz->a >= 1)
+    sz->dist = FCT_FIXED;
+  else if (sscanf(spec, "uniform:%lf:%lf", &sz->a, &sz->b) == 2 && sz->a >= 1 && sz->b >= sz->a)
+    sz->dist = FCT_UNIFORM;
+  else if (sscanf(spec, "pareto:%lf:%lf", &sz->a, &sz->b) == 2 && sz->a > 0 && sz->b >= 1)
+    sz->dist = FCT_PARETO;
+  else if (strncmp(spec, "cdf:", 4) == 0 && loadcdf(sz, spec + 4))
+    sz->dist = FCT_CDF;
+  else
+    return 0;
+  return 1;
+}
+
+void fct_free(struct fctsizes *sz)
+{
+  free(sz->cdfsize);
+  free(sz->cdfprob);
+  sz->cdfsize = sz->cdfprob = NULL;
+  sz->ncdf = 0;
+}
+
+/* a size from uniform number u */
+static double drawsize(const struct fctsizes *sz, double u)
+{
+  int i;
+
+  switch (sz->dist) {
+  case FCT_UNIFORM:
+    return floor(sz->a + u * (sz->b - sz->a + 1));
+  case FCT_PARETO:
+    return floor(sz->b * pow(1.0 - u, -1.0 / sz->a));
+  case FCT_CDF:
+    for (i = 0; i < sz->ncdf - 1 && sz->cdfprob[i] <= u; i++)
+      ;
+    return sz->cdfsize[i];
+  default:
+    return floor(sz->a);
+  }
+}
+
+void fct_draw(const struct fctsizes *sz, const struct simconfig *cfg, int n,
+              long long *size, double *start)
+{
+  uint64_t key = rng_key(cfg->seed, FCT_STREAM);
+  double t = 0.0, x;
+  int f;
+
+  for (f = 0; f < n; f++) {
+    x = drawsize(sz, rng_uniform(key, 2 * (uint64_t)f));
+    if (cfg->nsimmax > 0 && x > cfg->nsimmax)
+      x = cfg->nsimmax;
+    size[f] = x < 1e18 ? (long long)x : (long long)1e18;
+    if (f > 0)
+      t -= cfg->lambda * log1p(-rng_uniform(key, 2 * (uint64_t)f + 1));
+    start[f] = t;
+  }
+}
+
+/*************************** the report ******************************/
+
+static int cmpdouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* the p-quantile (nearest rank) of the n sorted values v */
+static double quantile(const double *v, int n, double p)
+{
+  int k = (int)ceil(p * n) - 1;
+
+  return v[k < 0 ? 0 : k];
+}
+
+static double mean(const double *v, int n)
+{
+  double sum = 0.0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    sum += v[i];
+  return n ? sum / n : 0.0;
+}
+
+static const double levels[] = { 0.5, 0.9, 0.99, 0.999 };
+#define NLEVELS (sizeof(levels) / sizeof(levels[0]))
+
+/* one line of percentiles of the n values v, which it sorts */
+static void percentiles(const char *name, double *v, int n)
+{
+  size_t i;
+
+  qsort(v, n, sizeof(double), cmpdouble);
+  printf("%-10s %12.3f", name, mean(v, n));
+  for (i = 0; i < NLEVELS; i++)
+    printf(" %12.3f", quantile(v, n, levels[i]));
+  printf(" %12.3f\n", v[n - 1]);
+}
+
+/* the same per decade of size, in messages */
+static void bysize(const struct flows *m, const struct flows *ideal, long long maxsize)
+{
+  double *fct = xmalloc(m->nflows * sizeof(double));
+  double *slow = xmalloc(m->nflows * sizeof(double));
+  long long lo, hi;
+  double t, t0;
+  int f, n;
+
+  printf("%-16s %8s %12s %12s %12s %12s %12s\n", "size", "flows", "fct mean",
+         "fct p50", "fct p99", "slow mean", "slow p99");
+  for (lo = 1; lo <= maxsize; lo *= 10) {
+    hi = lo * 10 - 1;
+    for (n = 0, f = 0; f < m->nflows; f++) {
+      if (m->size[f] < lo || m->size[f] > hi ||
+          (t = flows_fct(m, f)) < 0 || (t0 = flows_fct(ideal, f)) <= 0)
+        continue;
+      fct[n] = t;
+      slow[n++] = t / t0;
+    }
+    if (n == 0)
+      continue;
+    qsort(fct, n, sizeof(double), cmpdouble);
+    qsort(slow, n, sizeof(double), cmpdouble);
+    printf("%7lld-%-8lld %8d %12.3f %12.3f %12.3f %12.3f %12.3f\n", lo, hi, n,
+           mean(fct, n), quantile(fct, n, 0.5), quantile(fct, n, 0.99),
+           mean(slow, n), quantile(slow, n, 0.99));
+  }
+  free(fct);
+  free(slow);
+}
+
+void fct_report(const struct flows *m, const struct flows *ideal)
+{
+  double *fct = xmalloc(m->nflows * sizeof(double));
+  double *slow = xmalloc(m->nflows * sizeof(double));
+  long long maxsize = 0;
+  double t, t0;
+  char label[16];
+  int f, n = 0;
+  size_t i;
+
+  for (f = 0; f < m->nflows; f++) {
+    if ((t = flows_fct(m, f)) < 0 || (t0 = flows_fct(ideal, f)) <= 0)
+      continue;
+    fct[n] = t;
+    slow[n++] = t / t0;
+    if (m->size[f] > maxsize)
+      maxsize = m->size[f];
+  }
+  printf("flow completion times of %s: %d of %d flows finished\n", m->proto->name, n,
+         m->nflows);
+  if (n > 0) {
+    printf("%-10s %12s", "", "mean");
+    for (i = 0; i < NLEVELS; i++) {
+      snprintf(label, sizeof(label), "p%g", 100 * levels[i]);
+      printf(" %12s", label);
+    }
+    printf(" %12s\n", "max");
+    percentiles("fct", fct, n);
+    percentiles("slowdown", slow, n);
+    bysize(m, ideal, maxsize);
+  }
+  free(fct);
+  free(slow);
+}
@@ -0,0 +1,45 @@
+#ifndef FCT_H
+#define FCT_H
+
+#include "emulator.h"
+#include "flows.h"
+
+/* ******************************************************************
+   Flow completion time benchmarks: many finite transfers with sizes
+   (in messages) drawn from a distribution, measured by how long each
+   takes from its start to the delivery of its last message.
+**********************************************************************/
+
+/* size distributions */
+#define FCT_FIXED   0           /* every flow a messages */
+#define FCT_UNIFORM 1           /* uniform on a..b */
+#define FCT_PARETO  2           /* Pareto of shape a from b on */
+#define FCT_CDF     3           /* the empirical distribution in cdf */
+
+struct fctsizes {
+  int dist;                     /* FCT_... */
+  double a, b;
+  double *cdfsize, *cdfprob;    /* FCT_CDF: sizes and their cumulative
+                                   probabilities, both ascending */
+  int ncdf;
+};
+
+/* Set sz from a spec: fixed:N, uniform:MIN:MAX, pareto:SHAPE:MIN or
+   cdf:FILE, FILE holding lines of a size and the probability of a flow
+   being no larger, in ascending order.  Returns 0 if the spec is none
+   of these or the file cannot be read. */
+extern int fct_parse(struct fctsizes *sz, const char *spec);
+extern void fct_free(struct fctsizes *sz);
+
+/* Draw the sizes and start times of n flows from keyed numbers under
+   cfg->seed.  Flows start as a Poisson process of mean gap cfg->lambda
+   (all at 0 if it is 0); sizes are at most cfg->nsimmax if that is set. */
+extern void fct_draw(const struct fctsizes *sz, const struct simconfig *cfg, int n,
+                     long long *size, double *start);
+
+/* Print the completion time percentiles of the finite flows of m, their
+   slowdowns (completion time over that of the same flow in 'ideal', the
+   same flows run over a perfect channel) and both per decade of size. */
+extern void fct_report(const struct flows *m, const struct flows *ideal);
+
+#endif
@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "rng.h"
+#include "flows.h"
+
+/* ******************************************************************
+   The multi-flow model: the entity routines of the emulator, written so
+   that an entity only touches its own state and hands every event it
+   causes to the engine.  Random numbers are keyed per flow (streams
+   3*flow, 3*flow+1 and 3*flow+2 for arrivals and the two channel
+   directions), so flow 0 draws exactly what a keyed single-flow run
+   draws.  Timers are cancelled lazily: a timer event whose generation
+   is no longer the entity's running timer is ignored.
+**********************************************************************/
+
+#define STREAMS_PER_FLOW 3
+
+static void *xcalloc(size_t n, size_t size)
+{
+  void *p = calloc(n, size ? size : 1);
+
+  if (p == NULL) {
+    printf("memory allocation for flows failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void schedule(struct entity *e, struct fevent *ev)
+{
+  ev->src = e->id;
+  ev->seq = e->st.seq++;
+  e->model->schedule(e->owner, ev);
+}
+
+/* the student-callable routines reach these through curhost, whose
+   engine is the entity now running */
+
+static void fl_tolayer3(void *eng, int AorB, struct pkt packet)
+{
+  struct entity *e = eng;
+  uint64_t tx = e->st.ntx++;
+  double delay;
+  int corrupted;
+
+  e->st.ntolayer3++;
+  if (e->model->defer != NULL) {
+    e->model->defer(e->owner, e, tx, &packet);
+    return;
+  }
+  delay = channel_fate(&e->model->cfg, e->chankey, tx, e->side, &packet, &corrupted);
+  flows_transmit(e, &packet, delay, corrupted);
+}
+
+void flows_transmit(struct entity *e, const struct pkt *packet, double delay,
+                    int corrupted)
+{
+  struct fevent ev;
+  double t;
+
+  if (delay == CHANNEL_LOST) {
+    e->st.nlost++;
+    return;
+  }
+  e->st.ncorrupt += corrupted;
+  /* the channel does not reorder: arrive after the last packet sent */
+  t = (e->st.lastarrival > e->st.now ? e->st.lastarrival : e->st.now) + delay;
+  e->st.lastarrival = t;
+  ev.time = t;
+  ev.dst = e->id ^ 1;
+  ev.type = FEV_PACKET;
+  ev.gen = 0;
+  ev.pkt = *packet;
+  schedule(e, &ev);
+}
+
+static void fl_tolayer5(void *eng, int AorB, char datasent[20])
+{
+  struct entity *e = eng;
+
+  e->st.delivered++;
+  e->st.delivertime += e->st.now;
+  if (e->model->size != NULL && e->st.delivered == e->model->size[e->flow])
+    e->st.done = e->st.now;
+}
+
+static void fl_starttimer(void *eng, int AorB, double increment)
+{
+  struct entity *e = eng;
+  struct fevent ev;
+
+  if (e->st.timeron) {
+    if (TRACE>=0)
+      printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  e->st.timeron = 1;
+  ev.time = e->st.now + increment;
+  ev.dst = e->id;
+  ev.type = FEV_TIMER;
+  ev.gen = ++e->st.timergen;
+  schedule(e, &ev);
+}
+
+static void fl_stoptimer(void *eng, int AorB)
+{
+  struct entity *e = eng;
+
+  if (!e->st.timeron) {
+    if (TRACE>=0)
+      printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  e->st.timeron = 0;
+}
+
+static const struct hostops flowops = {
+  fl_tolayer3, fl_tolayer5, fl_starttimer, fl_stoptimer
+};
+
+struct flows *flows_create(const struct protocol *proto,
+                           const struct simconfig *cfg, int nflows)
+{
+  struct flows *m = xcalloc(1, sizeof(struct flows));
+  int i;
+
+  m->proto = proto;
+  m->cfg = *cfg;
+  m->nflows = nflows;
+  m->nent = 2 * nflows;
+  m->ent = xcalloc(m->nent, sizeof(struct entity));
+  for (i = 0; i < m->nent; i++) {
+    struct entity *e = &m->ent[i];
+
+    e->model = m;
+    e->id = i;
+    e->flow = i / 2;
+    e->side = i % 2;
+    e->ctxsize = e->side == A ? proto->A_size : proto->B_size;
+    e->ctx = xcalloc(1, e->ctxsize);
+    e->host.ops = &flowops;
+    e->host.eng = e;
+    e->host.stats = &e->st.stats;
+    e->chankey = rng_key(cfg->seed, STREAMS_PER_FLOW * e->flow + 1 + e->side);
+    e->arrkey = rng_key(cfg->seed, STREAMS_PER_FLOW * e->flow);
+  }
+  return m;
+}
+
+void flows_destroy(struct flows *m)
+{
+  int i;
+
+  for (i = 0; i < m->nent; i++) {
+    free(m->ent[i].ctx);
+    free(m->ent[i].accepted);
+  }
+  free(m->ent);
+  free(m->size);
+  free(m->start);
+  free(m);
+}
+
+void flows_setsizes(struct flows *m, const long long *size, const double *start)
+{
+  m->size = xcalloc(m->nflows, sizeof(long long));
+  m->start = xcalloc(m->nflows, sizeof(double));
+  memcpy(m->size, size, m->nflows * sizeof(long long));
+  memcpy(m->start, start, m->nflows * sizeof(double));
+  m->cfg.workload = WL_GREEDY;
+}
+
+double flows_fct(const struct flows *m, int flow)
+{
+  const struct entity *b = &m->ent[2 * flow + 1];
+
+  if (b->st.delivered < m->size[flow])
+    return -1.0;
+  return b->st.done - m->start[flow];
+}
+
+/*************************** event queues ******************************/
+
+void evbuf_push(struct evbuf *b, const struct fevent *ev)
+{
+  if (b->n == b->size) {
+    b->size = b->size ? 2 * b->size : 64;
+    b->ev = realloc(b->ev, b->size * sizeof(struct fevent));
+    if (b->ev == NULL) {
+      printf("memory allocation for events failed.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  b->ev[b->n++] = *ev;
+}
+
+static void siftup(struct evbuf *h, int i)
+{
+  struct fevent t;
+  int parent;
+
+  for (; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (!fevent_before(&h->ev[i], &h->ev[parent]))
+      break;
+    t = h->ev[i];
+    h->ev[i] = h->ev[parent];
+    h->ev[parent] = t;
+  }
+}
+
+static void siftdown(struct evbuf *h, int i)
+{
+  struct fevent t;
+  int c;
+
+  while ((c = 2 * i + 1) < h->n) {
+    if (c + 1 < h->n && fevent_before(&h->ev[c + 1], &h->ev[c]))
+      c++;
+    if (!fevent_before(&h->ev[c], &h->ev[i]))
+      break;
+    t = h->ev[i];
+    h->ev[i] = h->ev[c];
+    h->ev[c] = t;
+    i = c;
+  }
+}
+
+void evheap_insert(struct evbuf *h, const struct fevent *ev)
+{
+  evbuf_push(h, ev);
+  siftup(h, h->n - 1);
+}
+
+struct fevent evheap_pop(struct evbuf *h)
+{
+  struct fevent top = h->ev[0];
+
+  h->ev[0] = h->ev[--h->n];
+  siftdown(h, 0);
+  return top;
+}
+
+int evheap_remove(struct evbuf *h, int src, uint64_t seq)
+{
+  int i;
+
+  for (i = 0; i < h->n; i++)
+    if (h->ev[i].src == src && h->ev[i].seq == seq) {
+      h->ev[i] = h->ev[--h->n];
+      if (i < h->n) {
+        siftup(h, i);
+        siftdown(h, i);
+      }
+      return 1;
+    }
+  return 0;
+}
+
+/*************************** the entities ******************************/
+
+static double arrivaldraw(void *arg, int which)
+{
+  struct entity *e = arg;
+
+  return rng_uniform(e->arrkey, (uint64_t)e->st.nsim * CHANNEL_DRAWS + which);
+}
+
+/* messages sender e is to send */
+static long long nmessages(const struct flows *m, const struct entity *e)
+{
+  return m->size != NULL ? m->size[e->flow] : m->cfg.nsimmax;
+}
+
+/* schedule the next message from layer 5 of sender e, as
+   generate_next_arrival() does */
+static void next_arrival(struct flows *m, struct entity *e)
+{
+  struct fevent ev;
+  double gap = workload_gap(&m->cfg, &e->st.wl, e->st.now, arrivaldraw, e);
+
+  if (gap == WL_END)
+    return;
+  ev.time = e->st.now + gap;
+  ev.dst = e->id;
+  ev.type = FEV_ARRIVAL;
+  ev.gen = 0;
+  schedule(e, &ev);
+}
+
+static void accept(struct entity *e)
+{
+  if (e->st.naccepted == e->acceptsize) {
+    e->acceptsize = e->acceptsize ? 2 * e->acceptsize : 16;
+    e->accepted = realloc(e->accepted, e->acceptsize * sizeof(double));
+    if (e->accepted == NULL) {
+      printf("memory allocation for latency tracking failed.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  e->accepted[e->st.naccepted++] = e->st.now;
+}
+
+/* a greedy sender: hand e messages until it refuses one (see
+   greedy_offer()) */
+static void feed(struct flows *m, struct entity *e)
+{
+  struct msg msg2give;
+  int i;
+
+  while (e->st.nsim < nmessages(m, e)) {
+    for (i=0; i<20; i++)
+      msg2give.data[i] = 97 + e->st.nsim % 26;
+    if (!greedy_offer(m->proto, e->ctx, msg2give, &e->st.stats))
+      return;
+    e->st.nsim++;
+    accept(e);
+  }
+}
+
+void flows_start(struct flows *m)
+{
+  struct host *prevhost = curhost;
+  int i;
+
+  for (i = 0; i < m->nent; i++) {
+    struct entity *e = &m->ent[i];
+
+    curhost = &e->host;
+    if (e->side == A) {
+      workload_init(&e->st.wl);
+      m->proto->A_init(e->ctx);
+      if (m->start != NULL) {
+        /* a finite flow: its first message opens it, feed() does the rest */
+        struct fevent ev;
+
+        ev.time = m->start[e->flow];
+        ev.dst = e->id;
+        ev.type = FEV_ARRIVAL;
+        ev.gen = 0;
+        schedule(e, &ev);
+      }
+      else {
+        next_arrival(m, e);
+        if (m->cfg.workload == WL_GREEDY)
+          feed(m, e);
+      }
+    }
+    else
+      m->proto->B_init(e->ctx);
+  }
+  curhost = prevhost;
+}
+
+void flows_handle(struct flows *m, const struct fevent *ev)
+{
+  struct entity *e = &m->ent[ev->dst];
+  const struct protocol *p = m->proto;
+  struct host *prevhost = curhost;
+  uint64_t bits;
+  struct msg msg2give;
+  int i;
+
+  if (ev->type == FEV_TIMER && (!e->st.timeron || ev->gen != e->st.timergen))
+    return;                     /* a cancelled timer */
+
+  e->st.now = ev->time;
+  e->st.nevents++;
+  memcpy(&bits, &ev->time, sizeof(bits));
+  e->st.digest = rng_mix(e->st.digest ^ bits ^ ((uint64_t)ev->type << 62) ^
+                         ((uint64_t)ev->src << 32));
+  curhost = &e->host;
+  switch (ev->type) {
+  case FEV_ARRIVAL:
+    if (e->st.nsim < nmessages(m, e)) {
+      long long dropped = e->st.stats.window_full;
+
+      for (i=0; i<20; i++)
+        msg2give.data[i] = 97 + e->st.nsim % 26;
+      e->st.nsim++;
+      next_arrival(m, e);
+      p->A_output(e->ctx, msg2give);
+      if (e->st.stats.window_full == dropped)
+        accept(e);
+    }
+    break;
+  case FEV_PACKET:
+    if (e->side == A)
+      p->A_input(e->ctx, ev->pkt);
+    else
+      p->B_input(e->ctx, ev->pkt);
+    break;
+  case FEV_TIMER:
+    e->st.timeron = 0;
+    if (e->side == A)
+      p->A_timerinterrupt(e->ctx);
+    else
+      p->B_timerinterrupt(e->ctx);
+    break;
+  }
+  if (m->cfg.workload == WL_GREEDY && e->side == A)
+    feed(m, e);
+  curhost = prevhost;
+}
+
+/* add the totals of entity i to res; returns its share of the latency sum */
+static double addentity(const struct flows *m, int i, struct flowresult *res)
+{
+  const struct entity *e = &m->ent[i];
+  double latency = 0.0;
+  long long k;
+
+  res->delivered += e->st.delivered;
+  res->ntolayer3 += e->st.ntolayer3;
+  res->nlost += e->st.nlost;
+  res->ncorrupt += e->st.ncorrupt;
+  res->resent += e->st.stats.packets_resent;
+  res->acks += e->st.stats.new_ACKs;
+  res->nevents += e->st.nevents;
+  if (e->st.now > res->time)
+    res->time = e->st.now;
+  /* every entity contributes independently of the others, so the
+     digest does not depend on the order entities are visited in */
+  res->digest += rng_mix(e->st.digest ^ (uint64_t)e->id);
+  /* messages are delivered in the order they were accepted, so the
+     k-th delivery at B is the k-th acceptance at A */
+  if (e->side == B) {
+    const struct entity *a = &m->ent[i - 1];
+
+    latency += e->st.delivertime;
+    for (k = 0; k < e->st.delivered && k < a->st.naccepted; k++)
+      latency -= a->accepted[k];
+  }
+  return latency;
+}
+
+void flows_result(const struct flows *m, struct flowresult *res)
+{
+  double latency = 0.0;
+  int i;
+
+  memset(res, 0, sizeof(*res));
+  for (i = 0; i < m->nent; i++)
+    latency += addentity(m, i, res);
+  res->latency_avg = res->delivered ? latency / res->delivered : 0.0;
+}
+
+void flows_flowresult(const struct flows *m, int flow, struct flowresult *res)
+{
+  double latency;
+
+  memset(res, 0, sizeof(*res));
+  latency = addentity(m, 2 * flow, res) + addentity(m, 2 * flow + 1, res);
+  res->latency_avg = res->delivered ? latency / res->delivered : 0.0;
+}
+
+void flows_report(const struct flows *m)
+{
+  struct flowresult res;
+
+  flows_result(m, &res);
+  printf("%d flows of %s terminated at time %f\n", m->nflows, m->proto->name, res.time);
+  printf("messages delivered to application:  %lld \n", res.delivered);
+  printf("packets sent into layer 3:  %lld (%lld lost, %lld corrupted)\n",
+         res.ntolayer3, res.nlost, res.ncorrupt);
+  printf("packet resends by A:  %lld \n", res.resent);
+  printf("valid acknowledgements received at A:  %lld \n", res.acks);
+  printf("mean delivery latency:  %f \n", res.latency_avg);
+  printf("events handled:  %ld \n", res.nevents);
+  printf("event digest:  %016llx\n", (unsigned long long)res.digest);
+}
@@ -0,0 +1,150 @@
+#ifndef FLOWS_H
+#define FLOWS_H
+
+#include <stdint.h>
+#include "emulator.h"
+#include "workload.h"
+
+/* ******************************************************************
+   Many independent flows, each a sender A and a receiver B running the
+   same protocol over their own channel, for the parallel engines.
+
+   Each (flow, side) pair is an entity with its own protocol state,
+   clock and random number streams.  Entities only talk through events,
+   and an event from one entity to another is always at least
+   LOOKAHEAD time units in the future (the minimum channel delay), so
+   entities can be simulated on different threads.  Events are ordered
+   by (time, source entity, source sequence number), which does not
+   depend on how entities are spread over threads: every partitioning
+   processes every entity's events in the same order.
+**********************************************************************/
+
+#define LOOKAHEAD 1.0           /* minimum delay between two entities */
+
+/* event types */
+#define FEV_ARRIVAL 0           /* message from layer 5 at A */
+#define FEV_PACKET  1           /* packet from layer 3 */
+#define FEV_TIMER   2           /* timer interrupt */
+
+struct fevent {
+  double time;
+  int dst;                      /* entity the event happens at */
+  int src;                      /* entity that scheduled it */
+  uint64_t seq;                 /* src's count of events scheduled before */
+  int type;
+  uint64_t gen;                 /* timer generation (FEV_TIMER) */
+  struct pkt pkt;               /* FEV_PACKET */
+};
+
+/* total order of events: nonzero if a comes before b */
+static inline int fevent_before(const struct fevent *a, const struct fevent *b)
+{
+  if (a->time != b->time)
+    return a->time < b->time;
+  if (a->src != b->src)
+    return a->src < b->src;
+  return a->seq < b->seq;
+}
+
+/* growable array of events, also used as a binary heap ordered by
+   fevent_before() */
+struct evbuf {
+  struct fevent *ev;
+  int n, size;
+};
+
+extern void evbuf_push(struct evbuf *b, const struct fevent *ev);
+extern void evheap_insert(struct evbuf *h, const struct fevent *ev);
+extern struct fevent evheap_pop(struct evbuf *h);
+/* remove the event scheduled by src with sequence number seq; 0 if absent */
+extern int evheap_remove(struct evbuf *h, int src, uint64_t seq);
+
+/* the part of an entity that changes as it runs (so an engine can save
+   and restore it together with the protocol state) */
+struct entstate {
+  double now;                   /* time of the event being handled */
+  uint64_t seq;                 /* events scheduled so far */
+  int timeron;
+  uint64_t timergen;            /* generation of the running timer */
+  uint64_t ntx;                 /* packets sent into the channel */
+  double lastarrival;           /* arrival time of the last packet sent */
+  long long nsim;               /* messages from layer 5 so far (A) */
+  struct wlstate wl;            /* its workload model (A) */
+  long long naccepted;          /* of which accepted by the protocol (A) */
+  long long delivered;          /* messages delivered to layer 5 (B) */
+  double done;                  /* time the last message of a finite flow
+                                   was delivered (B) */
+  double delivertime;           /* sum of their delivery times (B) */
+  long long ntolayer3, nlost, ncorrupt;
+  long nevents;
+  uint64_t digest;              /* hash of the events handled */
+  struct protostats stats;
+};
+
+struct entity {
+  struct flows *model;
+  int id;                       /* 2*flow + side */
+  int flow, side;
+  void *ctx;                    /* protocol state */
+  size_t ctxsize;
+  struct host host;
+  void *owner;                  /* engine data of the thread running it */
+  uint64_t chankey;             /* channel stream of this side */
+  uint64_t arrkey;              /* arrival stream of the flow (A) */
+  double *accepted;             /* acceptance times, append only (A) */
+  long long acceptsize;
+  struct entstate st;
+};
+
+struct flows {
+  const struct protocol *proto;
+  struct simconfig cfg;
+  int nflows;
+  int nent;                     /* 2 * nflows */
+  struct entity *ent;
+  /* finite flows (see flows_setsizes()), or NULL */
+  long long *size;
+  double *start;
+  /* the engine's routine for scheduling an event */
+  void (*schedule)(void *owner, const struct fevent *ev);
+  /* if set, tolayer3() hands the tx-th packet of entity e to this
+     routine instead of deciding its fate; the engine later passes the
+     decision to flows_transmit() */
+  void (*defer)(void *owner, struct entity *e, uint64_t tx, struct pkt *packet);
+};
+
+/* totals over all entities */
+struct flowresult {
+  long long delivered, ntolayer3, nlost, ncorrupt, resent, acks;
+  long nevents;
+  double latency_avg;
+  double time;                  /* time of the last event handled */
+  uint64_t digest;              /* same for every partitioning */
+};
+
+extern struct flows *flows_create(const struct protocol *proto,
+                                  const struct simconfig *cfg, int nflows);
+extern void flows_destroy(struct flows *m);
+/* Make the flows finite transfers: flow f carries size[f] messages,
+   all waiting at its sender from time start[f] on (a greedy sender, so
+   the workload is ignored).  Call before flows_start(); the arrays are
+   copied. */
+extern void flows_setsizes(struct flows *m, const long long *size, const double *start);
+/* time from the start of finite flow f to the delivery of its last
+   message, or -1 if it was not delivered */
+extern double flows_fct(const struct flows *m, int flow);
+/* run the init routines and schedule the first arrivals; call once the
+   engine has set the owners and the schedule routine */
+extern void flows_start(struct flows *m);
+/* handle one event at its destination entity */
+extern void flows_handle(struct flows *m, const struct fevent *ev);
+/* send packet from e into the channel with the delay (or CHANNEL_LOST)
+   decided for it */
+extern void flows_transmit(struct entity *e, const struct pkt *packet, double delay,
+                           int corrupted);
+extern void flows_result(const struct flows *m, struct flowresult *res);
+/* the same, for a single flow */
+extern void flows_flowresult(const struct flows *m, int flow, struct flowresult *res);
+extern void flows_report(const struct flows *m);
+
+#endif
@@ -32,7 +32,7 @@
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct pkt packet)
 {
   int checksum = 0;
   int i;
@@ -45,7 +45,7 @@ int ComputeChecksum(struct pkt packet)
   return checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+static bool IsCorrupted(struct pkt packet)
 {
   if (packet.checksum == ComputeChecksum(packet))
     return (false);
@@ -56,24 +56,27 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+struct sender {
+  struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+};
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output(void *ctx, struct msg message)
 {
+  struct sender *s = ctx;
   struct pkt sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  if ( s->windowcount < WINDOWSIZE) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = s->A_nextseqnum;
     sendpkt.acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ ) 
       sendpkt.payload[i] = message.data[i];
@@ -81,9 +84,9 @@ void A_output(struct msg message)
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+    s->windowlast = (s->windowlast + 1) % WINDOWSIZE; 
+    s->buffer[s->windowlast] = sendpkt;
+    s->windowcount++;
 
     /* send out packet */
     if (TRACE > 0)
@@ -91,17 +94,17 @@ void A_output(struct msg message)
     tolayer3 (A, sendpkt);
 
     /* start timer if first packet in window */
-    if (windowcount == 1)
+    if (s->windowcount == 1)
       starttimer(A,RTT);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+    s->A_nextseqnum = (s->A_nextseqnum + 1) % SEQSPACE;  
   }
   /* if blocked,  window is full */
   else {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    stats()->window_full++;
   }
 }
 
@@ -109,8 +112,9 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4 
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input(void *ctx, struct pkt packet)
 {
+  struct sender *s = ctx;
   int ackcount = 0;
   int i;
 
@@ -118,12 +122,12 @@ void A_input(struct pkt packet)
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
+    stats()->total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+    if (s->windowcount != 0) {
+          int seqfirst = s->buffer[s->windowfirst].seqnum;
+          int seqlast = s->buffer[s->windowlast].seqnum;
           /* check case when seqnum has and hasn't wrapped */
           if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
               ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
@@ -131,7 +135,7 @@ void A_input(struct pkt packet)
             /* packet is a new ACK */
             if (TRACE > 0)
               printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
+            stats()->new_ACKs++;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
             if (packet.acknum >= seqfirst)
@@ -140,15 +144,15 @@ void A_input(struct pkt packet)
               ackcount = SEQSPACE - seqfirst + packet.acknum;
 
 	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            s->windowfirst = (s->windowfirst + ackcount) % WINDOWSIZE;
 
             /* delete the acked packets from window buffer */
             for (i=0; i<ackcount; i++)
-              windowcount--;
+              s->windowcount--;
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
-            if (windowcount > 0)
+            if (s->windowcount > 0)
               starttimer(A, RTT);
 
           }
@@ -163,20 +167,21 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void *ctx)
 {
+  struct sender *s = ctx;
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  for(i=0; i<s->windowcount; i++) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", (s->buffer[(s->windowfirst+i) % WINDOWSIZE]).seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
+    tolayer3(A,s->buffer[(s->windowfirst+i) % WINDOWSIZE]);
+    stats()->packets_resent++;
     if (i==0) starttimer(A,RTT);
   }
 }       
@@ -185,60 +190,64 @@ void A_timerinterrupt(void)
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void *ctx)
 {
+  struct sender *s = ctx;
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+  s->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  s->windowfirst = 0;
+  s->windowlast = -1;   /* windowlast is where the last packet sent is stored.  
 		     new packets are placed in winlast + 1 
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+  s->windowcount = 0;
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+struct receiver {
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+};
 
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void B_input(void *ctx, struct pkt packet)
 {
+  struct receiver *r = ctx;
   struct pkt sendpkt;
   int i;
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  if  ( (!IsCorrupted(packet))  && (packet.seqnum == r->expectedseqnum) ) {
     if (TRACE > 0)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
+    stats()->packets_received++;
 
     /* deliver to receiving application */
     tolayer5(B, packet.payload);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt.acknum = r->expectedseqnum;
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;        
+    r->expectedseqnum = (r->expectedseqnum + 1) % SEQSPACE;        
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0) 
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
+    if (r->expectedseqnum == 0)
       sendpkt.acknum = SEQSPACE - 1;
     else
-      sendpkt.acknum = expectedseqnum - 1;
+      sendpkt.acknum = r->expectedseqnum - 1;
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt.seqnum = r->B_nextseqnum;
+  r->B_nextseqnum = (r->B_nextseqnum + 1) % 2;
     
   /* we don't have any data to send.  fill payload with 0's */
   for ( i=0; i<20 ; i++ ) 
@@ -253,10 +262,11 @@ void B_input(struct pkt packet)
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void *ctx)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  struct receiver *r = ctx;
+  r->expectedseqnum = 0;
+  r->B_nextseqnum = 1;
 }
 
 /******************************************************************************
@@ -264,12 +274,18 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
+static void B_output(void *ctx, struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void *ctx)
 {
 }
 
+
+const struct protocol gbn_protocol = {
+  "gbn", sizeof(struct sender), sizeof(struct receiver),
+  A_init, A_output, A_input, A_timerinterrupt,
+  B_init, B_output, B_input, B_timerinterrupt
+};
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "emulator.h"
+#include "rng.h"
+#include "stats.h"
+#include "flows.h"
+#include "lanes.h"
+
+/* ******************************************************************
+   Lockstep lanes.  Every flow of the model is a lane: an independent
+   simulation with its own small event queue.  In each step every lane
+   handles its next event, so all lanes run the same code one after the
+   other while their state is hot, and the packets sent during the step
+   are not given to the channel one by one: tolayer3() only records
+   them, and at the end of the step the random draws for all of them
+   are made together in one pass over structure-of-arrays buffers.
+   The same pass turns the draws into the channel's decisions, as
+   channel_decide() would: lost or not, the delay, and which field (if
+   any) is corrupted, as compares and selects rather than branches.  The
+   probabilities are tested on the integer bits of the draws (see
+   rng_threshold()): a floating-point compare may trap, so the compiler
+   would keep the branches around it.  The pass is straight-line
+   arithmetic, which the compiler turns into SIMD code (it asks for
+   -fopenmp-simd; with -march=native it uses AVX2 or AVX-512).  Only
+   the results are then applied to the packets, one by one.
+
+   The protocol routines themselves, checksums included, belong to the
+   protocol and stay scalar.
+**********************************************************************/
+
+struct lanes {
+  struct flows *model;
+  struct evbuf *queue;          /* pending events of each lane */
+  /* packets sent during the current step */
+  int ntx, txsize;
+  struct entity **ent;
+  uint64_t *key;                /* channel stream */
+  uint64_t *index;              /* first draw of the packet in it */
+  int *affected;                /* loss and corruption apply to it */
+  struct pkt *pkt;
+  /* the decisions */
+  int *fate;                    /* FATE_... */
+  double *delay;                /* unless lost */
+};
+
+/* what the channel does to a packet */
+#define FATE_INTACT  0
+#define FATE_PAYLOAD 1          /* corrupts the payload */
+#define FATE_SEQNUM  2          /* or the sequence number */
+#define FATE_ACKNUM  3          /* or the acknowledgement number */
+#define FATE_LOST    4
+
+static void *xrealloc(void *p, size_t size)
+{
+  if ((p = realloc(p, size)) == NULL) {
+    printf("memory allocation for lanes failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void lanes_schedule(void *owner, const struct fevent *ev)
+{
+  struct lanes *l = owner;
+
+  evheap_insert(&l->queue[ev->dst / 2], ev);
+}
+
+static void lanes_defer(void *owner, struct entity *e, uint64_t tx, struct pkt *packet)
+{
+  struct lanes *l = owner;
+  const struct simconfig *cfg = &l->model->cfg;
+
+  if (l->ntx == l->txsize) {
+    l->txsize = l->txsize ? 2 * l->txsize : 64;
+    l->ent = xrealloc(l->ent, l->txsize * sizeof(struct entity *));
+    l->key = xrealloc(l->key, l->txsize * sizeof(uint64_t));
+    l->index = xrealloc(l->index, l->txsize * sizeof(uint64_t));
+    l->affected = xrealloc(l->affected, l->txsize * sizeof(int));
+    l->pkt = xrealloc(l->pkt, l->txsize * sizeof(struct pkt));
+    l->fate = xrealloc(l->fate, l->txsize * sizeof(int));
+    l->delay = xrealloc(l->delay, l->txsize * sizeof(double));
+  }
+  l->ent[l->ntx] = e;
+  l->key[l->ntx] = e->chankey;
+  l->index[l->ntx] = tx * CHANNEL_DRAWS;
+  l->affected[l->ntx] = !(e->side == B && cfg->corruptdirection == A) &&
+                        !(e->side == A && cfg->corruptdirection == B);
+  l->pkt[l->ntx] = *packet;
+  l->ntx++;
+}
+
+/* decide the fate of every packet of the step, then send them */
+static void channel(struct lanes *l)
+{
+  const uint64_t *key = l->key, *index = l->index;
+  const int *affected = l->affected;
+  uint64_t lossprob = rng_threshold(l->model->cfg.lossprob),
+           corruptprob = rng_threshold(l->model->cfg.corruptprob),
+           payload = rng_threshold(.75), seqnum = rng_threshold(.875);
+  double *delay = l->delay;
+  int *fate = l->fate;
+  int n = l->ntx, i;
+
+#pragma omp simd
+  for (i = 0; i < n; i++) {
+    uint64_t loss = rng_bits(key[i], index[i] + DRAW_LOSS);
+    uint64_t wait = rng_bits(key[i], index[i] + DRAW_DELAY);
+    uint64_t corrupt = rng_bits(key[i], index[i] + DRAW_CORRUPT);
+    uint64_t which = rng_bits(key[i], index[i] + DRAW_CORRUPTION);
+    int lost = affected[i] & (loss < lossprob);
+    int hit = affected[i] & !lost & (corrupt < corruptprob);
+    int field = FATE_PAYLOAD + (which >= payload) + (which >= seqnum);
+
+    fate[i] = lost ? FATE_LOST : hit ? field : FATE_INTACT;
+    delay[i] = 1 + 9*(wait * 0x1.0p-53);
+  }
+  for (i = 0; i < n; i++) {
+    struct pkt *p = &l->pkt[i];
+
+    switch (fate[i]) {
+    case FATE_PAYLOAD: p->payload[0] = 'Z'; break;
+    case FATE_SEQNUM:  p->seqnum = 999999; break;
+    case FATE_ACKNUM:  p->acknum = 999999; break;
+    }
+    flows_transmit(l->ent[i], p, fate[i] == FATE_LOST ? CHANNEL_LOST : delay[i],
+                   fate[i] != FATE_INTACT && fate[i] != FATE_LOST);
+  }
+  l->ntx = 0;
+}
+
+long lanes_run(struct flows *m)
+{
+  struct lanes l = { 0 };
+  double stop = m->cfg.stop_time > 0 ? m->cfg.stop_time : 0;
+  long steps = 0;
+  int i, active;
+
+  l.model = m;
+  l.queue = calloc(m->nflows, sizeof(struct evbuf));
+  if (l.queue == NULL) {
+    printf("memory allocation for lanes failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < m->nent; i++)
+    m->ent[i].owner = &l;
+  m->schedule = lanes_schedule;
+  m->defer = lanes_defer;
+  flows_start(m);
+  channel(&l);
+
+  do {
+    active = 0;
+    for (i = 0; i < m->nflows; i++) {
+      struct evbuf *q = &l.queue[i];
+      struct fevent ev;
+
+      if (q->n == 0 || (stop > 0 && q->ev[0].time > stop))
+        continue;
+      ev = evheap_pop(q);
+      flows_handle(m, &ev);
+      active++;
+    }
+    channel(&l);
+    steps++;
+  } while (active > 0);
+
+  m->defer = NULL;
+  for (i = 0; i < m->nflows; i++)
+    free(l.queue[i].ev);
+  free(l.queue);
+  free(l.ent);
+  free(l.key);
+  free(l.index);
+  free(l.affected);
+  free(l.pkt);
+  free(l.fate);
+  free(l.delay);
+  return steps;
+}
+
+void lanes_report(const struct flows *m)
+{
+  static const char *names[] = { "delivered", "latency", "resent", "end time" };
+  struct summary s[4];
+  struct flowresult r;
+  int f, i;
+
+  for (i = 0; i < 4; i++)
+    summary_init(&s[i]);
+  for (f = 0; f < m->nflows; f++) {
+    flows_flowresult(m, f, &r);
+    summary_add(&s[0], r.delivered);
+    summary_add(&s[1], r.latency_avg);
+    summary_add(&s[2], r.resent);
+    summary_add(&s[3], r.time);
+  }
+  printf("%d lanes of %s\n", m->nflows, m->proto->name);
+  printf("%-12s %12s %12s %12s\n", "measure", "mean", "std dev", "+/- 95%");
+  for (i = 0; i < 4; i++)
+    printf("%-12s %12.6g %12.6g %12.6g\n", names[i], s[i].mean, summary_sd(&s[i]),
+           summary_halfwidth(&s[i], 0.95));
+}
@@ -0,0 +1,17 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "flows.h"
+
+/* ******************************************************************
+   Many independent replications advanced in lockstep on one thread.
+**********************************************************************/
+
+/* Run every flow of the model as an independent lane, to the end (or
+   to cfg.stop_time).  The runs are the same as pdes_run() makes of the
+   model.  Returns the number of lockstep steps taken. */
+extern long lanes_run(struct flows *m);
+/* print the mean and confidence interval over the lanes of each measure */
+extern void lanes_report(const struct flows *m);
+
+#endif
@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "emulator.h"
+#include "sr.h"
+#include "gbn.h"
+#include "experiment.h"
+#include "flows.h"
+#include "pdes.h"
+#include "tw.h"
+#include "lanes.h"
+#include "replay.h"
+#include "workload.h"
+#include "fct.h"
+#include "realtime.h"
+#include "udp.h"
+
+/* ******************************************************************
+   Command line driver for the network emulator.
+
+   The protocol to simulate is chosen with -p, or else by the name the
+   program was started under, so the sr and gbn programs built by the
+   Makefile are the same binary.  Without simulation parameters on the
+   command line they are read from standard input exactly as the
+   original emulator did.
+
+   With -r, the simulation is instead replicated over that many seeds on
+   -j threads and summarised with confidence intervals; -e stops as soon
+   as they are within the given relative precision; with -I the losses
+   are importance-sampled and the replications weighted, for estimating
+   the probability of rare outcomes such as a message later than -R.
+   With -C other, the protocol is compared against another one over -r
+   replications that share their random numbers.
+
+   With -o the state of the run is written to a snapshot file when it
+   stops, and with -K also every so many seconds while it runs; -i
+   carries on from a snapshot, whose parameters the other options then
+   change (a later stop time, say).  With -x the snapshot is instead
+   continued once for each of several values of one parameter, on -j
+   threads, to see how the run would go on under each.
+
+   With -y every call the run makes into the protocol is logged to a
+   file, and -Y makes the logged calls again into the protocol alone,
+   without the emulator, for debugging and profiling it.
+
+   With -X scale the run is made in real time instead, one time unit
+   lasting that many seconds of the monotonic clock, with the messages
+   handed down by -j application threads; -U runs A and B on threads
+   of their own that exchange the packets over UDP on the loopback
+   interface, -b packets to a sendmmsg() or recvmmsg() call, or with
+   -G a batch to a single send() cut up by the kernel (UDP GSO).
+
+   With -F flows, that many independent copies of the flow are run on
+   the parallel engine, spread over -j threads; -O uses the optimistic
+   (Time Warp) engine instead of the conservative one; with -z the flows
+   are finite transfers of sizes drawn from a distribution, starting -m
+   apart on average, and their completion times are reported.  With
+   -L lanes, that many independent replications run in lockstep on one
+   thread.
+**********************************************************************/
+
+#define OPTIONS "p:n:l:c:d:m:s:kgSu:v:w:W:MT:t:D:P:C:r:j:e:F:OL:I:R:i:o:K:x:y:Y:A:z:X:Ub:G"
+
+static const struct protocol *protocols[] = {
+  &sr_protocol,
+  &gbn_protocol,
+};
+#define NPROTOCOLS (sizeof(protocols) / sizeof(protocols[0]))
+
+static const struct protocol *findprotocol(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < NPROTOCOLS; i++)
+    if (strcmp(protocols[i]->name, name) == 0)
+      return protocols[i];
+  return NULL;
+}
+
+static void usage(const char *prog)
+{
+  size_t i;
+
+  printf("usage: %s [-p protocol] [-n msgs] [-l loss] [-c corrupt] [-d direction]\n"
+         "          [-m mean-interarrival] [-A workload] [-s seed] [-k] [-g]\n"
+         "          [-u ticks] [-S]\n"
+         "          [-v trace]\n"
+         "          [-w warmup-time] [-W warmup-msgs] [-M]\n"
+         "          [-T stop-time] [-t wall-seconds] [-D delivered] [-P precision]\n"
+         "          [-r replications [-j threads] [-e precision]] [-C protocol]\n"
+         "          [-F flows [-j threads] [-O] [-z sizes]] [-L lanes] [-I biased-loss] [-R late]\n"
+         "          [-i snapshot [-x param=v1,v2,... [-j threads]]]\n"
+         "          [-o snapshot [-K seconds]] [-y log] [-Y log]\n"
+         "          [-X seconds-per-unit [-j threads] [-U [-b batch] [-G]]]\n"
+         "  -A  how messages arrive: uniform (default), poisson, cbr, onoff:ON:OFF\n"
+         "      (mean burst and silence lengths), pareto:SHAPE (objects of\n"
+         "      heavy-tailed message counts), trace:FILE (arrival times) or\n"
+         "      greedy (whenever the window has room)\n"
+         "  -k  keyed random numbers instead of rand()\n"
+         "  -u  clock ticks per time unit (64-bit integer clock; default float)\n"
+         "  -g  skip ahead to the next loss or corruption (fast at tiny rates)\n"
+         "  -S  report the memory the run held (constant in the run length)\n"
+         "  -w, -W  discard statistics gathered before this time / message count\n"
+         "  -M  detect the end of the warm-up with MSER-5 and discard it\n"
+         "  -T, -t, -D  stop at this simulated time / wall time / delivery count\n"
+         "  -P  stop when the mean latency is known to within this fraction\n"
+         "  -r  replicate over this many seeds and report confidence intervals\n"
+         "  -e  stop replicating when intervals are within this fraction of the mean\n"
+         "  -C  compare with another protocol using common random numbers\n"
+         "  -F  simulate this many flows on the parallel engine (keyed numbers)\n"
+         "  -O  use the optimistic (Time Warp) parallel engine\n"
+         "  -z  make the flows finite, of sizes fixed:N, uniform:MIN:MAX,\n"
+         "      pareto:SHAPE:MIN or cdf:FILE (at most -n), and report their\n"
+         "      completion times against a perfect channel\n"
+         "  -L  run this many replications in lockstep on one thread\n"
+         "  -I  importance sampling: lose packets with this probability and\n"
+         "      weight the replications (-r) by their likelihood ratio\n"
+         "  -R  a message delivered later than this is late (the rare event)\n"
+         "  -i  resume the run saved in this snapshot\n"
+         "  -o  save the run to this snapshot when it stops\n"
+         "  -K  also save it every this many seconds of wall-clock time\n"
+         "  -x  continue the snapshot once per value of loss, corrupt, lambda\n"
+         "      or seed (keyed numbers)\n"
+         "  -y  log every call into the protocol to this file\n"
+         "  -Y  replay the calls logged in this file into the protocol alone\n"
+         "  -X  run in real time, a time unit lasting this many seconds, the\n"
+         "      messages handed down by -j application threads\n"
+         "  -U  send the packets of the real-time run over UDP on the loopback\n"
+         "  -b  packets per system call over UDP (default 64, 1 sends each alone)\n"
+         "  -G  send each batch as one datagram the kernel segments (UDP GSO)\n"
+         "protocols:", prog);
+  for (i = 0; i < NPROTOCOLS; i++)
+    printf(" %s", protocols[i]->name);
+  printf("\n");
+  exit(EXIT_FAILURE);
+}
+
+/* ask for the simulation parameters, as the original emulator did */
+static void prompt(struct simconfig *cfg)
+{
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%lld",&cfg->nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&cfg->lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&cfg->corruptprob);
+  if (cfg->lossprob != 0.0 || cfg->corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&cfg->corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&cfg->lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+}
+
+static struct sim *loadsnapshot(const struct protocol *proto, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  struct sim *s;
+
+  if (f == NULL) {
+    printf("cannot open snapshot %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  s = sim_load(proto, f);
+  fclose(f);
+  if (s == NULL)
+    exit(EXIT_FAILURE);
+  return s;
+}
+
+/* write to a new file and rename it over the old one, so a crash while
+   writing leaves the previous snapshot whole */
+static void savesnapshot(const struct sim *s, const char *path)
+{
+  char tmp[4096];
+  FILE *f;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((f = fopen(tmp, "wb")) == NULL || sim_save(s, f) != 0 || fclose(f) != 0 ||
+      rename(tmp, path) != 0) {
+    printf("cannot write snapshot %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Run s, saving it to 'path' (if not NULL) when it stops and, with
+   every > 0, each time it has run that many more seconds, so a crash
+   loses at most that much of a long run.  The pauses are wall-clock
+   stops, which do not change the course of the run. */
+static void runsaving(struct sim *s, const struct simconfig *cfg, const char *path,
+                      double every)
+{
+  struct simconfig part = *cfg;
+  struct simresult res;
+  double left = cfg->wall_budget;
+
+  for (;;) {
+    if (every > 0) {
+      part.wall_budget = left > 0 && left < every ? left : every;
+      sim_setconfig(s, &part);
+    }
+    sim_run(s);
+    if (every > 0) {
+      sim_setconfig(s, cfg);    /* the snapshot keeps the real budget */
+      left -= part.wall_budget;
+    }
+    if (path != NULL)
+      savesnapshot(s, path);
+    sim_result(s, &res);
+    if (every <= 0 || res.stopreason != STOP_WALL || (cfg->wall_budget > 0 && left <= 0))
+      break;
+  }
+}
+
+/* -x param=v1,v2,...: continue s once for each value */
+static void runwhatif(const struct sim *s, const struct simconfig *cfg, char *spec,
+                      int threads, const char *prog)
+{
+  struct simconfig check = *cfg;
+  char *eq = strchr(spec, '='), *p, *end;
+  double *values;
+  int n = 1;
+
+  if (eq == NULL)
+    usage(prog);
+  *eq = '\0';
+  if (!setparam(&check, spec, 0.0))
+    usage(prog);
+  for (p = eq + 1; *p != '\0'; p++)
+    n += *p == ',';
+  values = malloc(n * sizeof(double));
+  if (values == NULL) {
+    printf("memory allocation for parameter values failed\n");
+    exit(EXIT_FAILURE);
+  }
+  for (n = 0, p = eq + 1; ; p = end + 1) {
+    values[n++] = strtod(p, &end);
+    if (end == p)
+      usage(prog);
+    if (*end != ',')
+      break;
+  }
+  if (*end != '\0')
+    usage(prog);
+  whatif(s, cfg, spec, values, n, threads);
+  free(values);
+}
+
+static void replaylog(const struct protocol *proto, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  struct replayresult res;
+
+  if (f == NULL) {
+    printf("cannot open log %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  if (replay_run(proto, f, &res) != 0)
+    exit(EXIT_FAILURE);
+  fclose(f);
+  replay_report(proto, &res);
+}
+
+/* -z: make the flows of f finite transfers, and run the same transfers
+   over a perfect channel into *ideal for their reference times */
+static void runfinite(struct flows *f, struct flows **ideal, const struct fctsizes *sizes,
+                      int optimistic, int threads)
+{
+  struct simconfig clean = f->cfg;
+  long long *size = malloc(f->nflows * sizeof(long long));
+  double *start = malloc(f->nflows * sizeof(double));
+  struct twstats tws;
+
+  if (size == NULL || start == NULL) {
+    printf("memory allocation for flow sizes failed\n");
+    exit(EXIT_FAILURE);
+  }
+  fct_draw(sizes, &f->cfg, f->nflows, size, start);
+  flows_setsizes(f, size, start);
+  clean.lossprob = 0.0;
+  clean.corruptprob = 0.0;
+  *ideal = flows_create(f->proto, &clean, f->nflows);
+  flows_setsizes(*ideal, size, start);
+  if (optimistic)
+    tw_run(*ideal, threads, &tws);
+  else
+    pdes_run(*ideal, threads);
+  free(size);
+  free(start);
+}
+
+int main(int argc, char **argv)
+{
+  const struct protocol *proto, *other = NULL;
+  struct simconfig cfg;
+  struct sim *s = NULL;
+  const char *prog, *snapin = NULL, *snapout = NULL;
+  const char *recpath = NULL, *replaypath = NULL;
+  char *variants = NULL;
+  FILE *rec = NULL;
+  int c, given = 0, replications = 0, threads = 1, trace = -2, nflows = 0;
+  int optimistic = 0, nlanes = 0, showmemory = 0, udp = 0;
+  struct udpconfig ucfg = { UDP_BATCH, 0 };
+  struct fctsizes sizes;
+  int finite = 0;
+  double precision = 0.0, every = 0.0, scale = 0.0;
+
+  prog = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+  proto = findprotocol(prog);
+  if (proto == NULL)
+    proto = &sr_protocol;
+  simconfig_default(&cfg);
+
+  /* a snapshot supplies the parameters the other options change, so
+     look for it (and the protocol it is of) first */
+  opterr = 0;
+  while ((c = getopt(argc, argv, OPTIONS)) != -1)
+    if (c == 'p' && (proto = findprotocol(optarg)) == NULL)
+      usage(prog);
+    else if (c == 'i')
+      snapin = optarg;
+  if (snapin != NULL) {
+    s = loadsnapshot(proto, snapin);
+    sim_getconfig(s, &cfg);
+    given = 1;
+  }
+  opterr = 1;
+  optind = 1;
+
+  while ((c = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (c) {
+    case 'p':
+      if ((proto = findprotocol(optarg)) == NULL)
+        usage(prog);
+      break;
+    case 'n': cfg.nsimmax = atoll(optarg); given = 1; break;
+    case 'l': cfg.lossprob = atof(optarg); given = 1; break;
+    case 'c': cfg.corruptprob = atof(optarg); given = 1; break;
+    case 'd': cfg.corruptdirection = atoi(optarg); given = 1; break;
+    case 'm': cfg.lambda = atof(optarg); given = 1; break;
+    case 'A':
+      if (!workload_parse(&cfg, optarg))
+        usage(prog);
+      break;
+    case 's': cfg.seed = strtoul(optarg, NULL, 10); break;
+    case 'k': cfg.rng = RNG_KEYED; break;
+    case 'g': cfg.skipahead = 1; break;
+    case 'S': showmemory = 1; break;
+    case 'u': cfg.ticks = atof(optarg); break;
+    case 'v': trace = atoi(optarg); break;
+    case 'w': cfg.warmup_time = atof(optarg); break;
+    case 'W': cfg.warmup_msgs = atoll(optarg); break;
+    case 'M': cfg.mser = 1; break;
+    case 'T': cfg.stop_time = atof(optarg); break;
+    case 't': cfg.wall_budget = atof(optarg); break;
+    case 'D': cfg.stop_delivered = atoll(optarg); break;
+    case 'P': cfg.stop_precision = atof(optarg); break;
+    case 'C':
+      if ((other = findprotocol(optarg)) == NULL)
+        usage(prog);
+      break;
+    case 'r': replications = atoi(optarg); break;
+    case 'j': threads = atoi(optarg); break;
+    case 'e': precision = atof(optarg); break;
+    case 'F': nflows = atoi(optarg); break;
+    case 'O': optimistic = 1; break;
+    case 'z':
+      if (!fct_parse(&sizes, optarg))
+        usage(prog);
+      finite = 1;
+      break;
+    case 'L': nlanes = atoi(optarg); break;
+    case 'I': cfg.is_lossprob = atof(optarg); break;
+    case 'R': cfg.late_latency = atof(optarg); break;
+    case 'i': break;            /* loaded above */
+    case 'o': snapout = optarg; break;
+    case 'K': every = atof(optarg); break;
+    case 'x': variants = optarg; break;
+    case 'y': recpath = optarg; break;
+    case 'Y': replaypath = optarg; given = 1; break;
+    case 'X': scale = atof(optarg); break;
+    case 'U': udp = 1; break;
+    case 'b': ucfg.batch = atoi(optarg); break;
+    case 'G': ucfg.gso = 1; break;
+    default:
+      usage(prog);
+    }
+  }
+  if (optind < argc || (every > 0 && snapout == NULL) || (variants != NULL && s == NULL) ||
+      (recpath != NULL && s != NULL) || (finite && nflows == 0) ||
+      (udp && scale <= 0) || ucfg.batch < 1 || ucfg.batch > UDP_BATCH)
+    usage(prog);
+
+  if (!given)
+    prompt(&cfg);
+  if (trace != -2)
+    TRACE = trace;
+  else if (given)
+    TRACE = 0;
+
+  if (replaypath != NULL) {
+    replaylog(proto, replaypath);
+    return EXIT_SUCCESS;
+  }
+
+  if (scale > 0) {
+    struct rtresult res;
+
+    if (threads < 1)
+      usage(prog);
+    if (udp)
+      udp_run(proto, &cfg, scale, threads, &ucfg, &res);
+    else
+      realtime_run(proto, &cfg, scale, threads, &res);
+    realtime_report(proto, &res);
+    return EXIT_SUCCESS;
+  }
+
+  if (nlanes > 0) {
+    struct flows *f = flows_create(proto, &cfg, nlanes);
+    long steps = lanes_run(f);
+
+    lanes_report(f);
+    flows_report(f);
+    printf("lockstep engine: %ld steps\n", steps);
+    flows_destroy(f);
+    return EXIT_SUCCESS;
+  }
+
+  if (nflows > 0) {
+    struct flows *f = flows_create(proto, &cfg, nflows), *ideal = NULL;
+    struct timespec t0, t1;
+    struct twstats tws;
+    long windows = 0;
+    double elapsed;
+
+    if (finite) {
+      runfinite(f, &ideal, &sizes, optimistic, threads);
+      fct_free(&sizes);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (optimistic)
+      tw_run(f, threads, &tws);
+    else
+      windows = pdes_run(f, threads);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    elapsed = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+    flows_report(f);
+    if (ideal != NULL) {
+      fct_report(f, ideal);
+      flows_destroy(ideal);
+    }
+    if (optimistic)
+      printf("Time Warp engine: %d threads, %ld GVT rounds, %.3f s\n"
+             "events handled %ld, undone %ld in %ld rollbacks, %ld anti-messages\n",
+             threads, tws.rounds, elapsed, tws.processed, tws.rolledback,
+             tws.rollbacks, tws.antimessages);
+    else
+      printf("parallel engine: %d threads, %ld windows, %.3f s\n", threads, windows,
+             elapsed);
+    flows_destroy(f);
+    return EXIT_SUCCESS;
+  }
+
+  if (variants != NULL) {
+    if (trace == -2)
+      TRACE = -1;
+    runwhatif(s, &cfg, variants, threads, prog);
+    sim_destroy(s);
+    return EXIT_SUCCESS;
+  }
+
+  if (other != NULL || replications > 0) {
+    if (trace == -2)
+      TRACE = -1;
+    if (other == NULL)
+      replicate(proto, &cfg, replications, threads, precision);
+    else if (replications >= 2)
+      compare_protocols(proto, other, &cfg, replications);
+    else
+      usage(prog);
+    return EXIT_SUCCESS;
+  }
+
+  if (s == NULL)
+    s = sim_create(proto, &cfg);
+  else
+    sim_setconfig(s, &cfg);
+  if (recpath != NULL) {
+    if ((rec = fopen(recpath, "wb")) == NULL) {
+      printf("cannot write log %s\n", recpath);
+      exit(EXIT_FAILURE);
+    }
+    sim_record(s, rec);
+  }
+  runsaving(s, &cfg, snapout, every);
+  if (rec != NULL && fclose(rec) != 0) {
+    printf("cannot write log %s\n", recpath);
+    exit(EXIT_FAILURE);
+  }
+  sim_report(s);
+  if (showmemory) {
+    struct simresult res;
+
+    sim_result(s, &res);
+    printf("memory held:  %zu bytes\n", res.memory);
+  }
+  sim_destroy(s);
+  return EXIT_SUCCESS;
+}
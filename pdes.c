@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "flows.h"
+#include "pdes.h"
+
+/* ******************************************************************
+   YAWNS-style conservative synchronisation.  The entities are split
+   over partitions, one thread each, and time advances in windows: all
+   partitions agree on the earliest pending event time T, and then each
+   handles its own events before T + LOOKAHEAD without talking to the
+   others.  Nothing another partition schedules during the window can
+   fall inside it, because every event between entities is at least
+   LOOKAHEAD in the future.  Events for other partitions are collected
+   in per-destination outboxes and handed over between windows.
+
+   A's and B's of the same flow are put on different partitions where
+   possible, so the engine is exercised even though flows are
+   independent; that is the multi-hop case in miniature.
+**********************************************************************/
+
+struct part {
+  int id;
+  struct pdes *eng;
+  struct evbuf heap;            /* pending events, a heap */
+  struct evbuf *out;            /* events for each other partition */
+};
+
+struct pdes {
+  struct flows *model;
+  int nparts;
+  struct part *parts;
+  double *mins;                 /* each partition's earliest event time */
+  pthread_barrier_t barrier;
+  long windows;
+};
+
+/* the model's schedule routine: owner is the scheduling entity's partition */
+static void pdes_schedule(void *owner, const struct fevent *ev)
+{
+  struct part *p = owner;
+  struct part *dst = p->eng->model->ent[ev->dst].owner;
+
+  if (dst == p)
+    evheap_insert(&p->heap, ev);
+  else
+    evbuf_push(&p->out[dst->id], ev);
+}
+
+static void *partition(void *arg)
+{
+  struct part *p = arg;
+  struct pdes *eng = p->eng;
+  struct flows *m = eng->model;
+  double stop = m->cfg.stop_time > 0 ? m->cfg.stop_time : INFINITY;
+  double t, end;
+  int q, i;
+
+  for (;;) {
+    eng->mins[p->id] = p->heap.n ? p->heap.ev[0].time : INFINITY;
+    pthread_barrier_wait(&eng->barrier);
+    for (t = INFINITY, q = 0; q < eng->nparts; q++)
+      if (eng->mins[q] < t)
+        t = eng->mins[q];
+    if (t == INFINITY || t > stop)
+      break;
+    if (p->id == 0)
+      eng->windows++;
+    end = t + LOOKAHEAD;
+    while (p->heap.n && p->heap.ev[0].time < end && p->heap.ev[0].time <= stop) {
+      struct fevent ev = evheap_pop(&p->heap);
+      flows_handle(m, &ev);
+    }
+    /* everyone has filled their outboxes and read mins[] */
+    pthread_barrier_wait(&eng->barrier);
+    for (q = 0; q < eng->nparts; q++) {
+      struct evbuf *in = &eng->parts[q].out[p->id];
+      for (i = 0; i < in->n; i++)
+        evheap_insert(&p->heap, &in->ev[i]);
+      in->n = 0;
+    }
+  }
+  return NULL;
+}
+
+long pdes_run(struct flows *m, int nparts)
+{
+  struct pdes eng;
+  pthread_t *tid;
+  int i, q;
+
+  if (nparts < 1)
+    nparts = 1;
+  eng.model = m;
+  eng.nparts = nparts;
+  eng.windows = 0;
+  eng.parts = calloc(nparts, sizeof(struct part));
+  eng.mins = calloc(nparts, sizeof(double));
+  tid = calloc(nparts, sizeof(pthread_t));
+  if (eng.parts == NULL || eng.mins == NULL || tid == NULL) {
+    printf("memory allocation for partitions failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nparts; i++) {
+    eng.parts[i].id = i;
+    eng.parts[i].eng = &eng;
+    eng.parts[i].out = calloc(nparts, sizeof(struct evbuf));
+    if (eng.parts[i].out == NULL) {
+      printf("memory allocation for partitions failed.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  /* the two ends of a flow go half the partitions apart */
+  for (i = 0; i < m->nent; i++) {
+    struct entity *e = &m->ent[i];
+    e->owner = &eng.parts[(e->flow + (e->side == B ? nparts / 2 : 0)) % nparts];
+  }
+  m->schedule = pdes_schedule;
+  flows_start(m);
+  /* the first arrivals were scheduled from outside any window */
+  for (i = 0; i < nparts; i++)
+    for (q = 0; q < nparts; q++) {
+      struct evbuf *in = &eng.parts[i].out[q];
+      int k;
+      for (k = 0; k < in->n; k++)
+        evheap_insert(&eng.parts[q].heap, &in->ev[k]);
+      in->n = 0;
+    }
+
+  pthread_barrier_init(&eng.barrier, NULL, nparts);
+  for (i = 1; i < nparts; i++)
+    if (pthread_create(&tid[i], NULL, partition, &eng.parts[i]) != 0) {
+      printf("cannot start partition thread\n");
+      exit(EXIT_FAILURE);
+    }
+  partition(&eng.parts[0]);     /* this thread runs partition 0 */
+  for (i = 1; i < nparts; i++)
+    pthread_join(tid[i], NULL);
+  pthread_barrier_destroy(&eng.barrier);
+
+  for (i = 0; i < nparts; i++) {
+    for (q = 0; q < nparts; q++)
+      free(eng.parts[i].out[q].ev);
+    free(eng.parts[i].out);
+    free(eng.parts[i].heap.ev);
+  }
+  free(eng.parts);
+  free(eng.mins);
+  free(tid);
+  return eng.windows;
+}
@@ -0,0 +1,16 @@
+#ifndef PDES_H
+#define PDES_H
+
+#include "flows.h"
+
+/* ******************************************************************
+   Conservative parallel engine for the multi-flow model.
+**********************************************************************/
+
+/* Run the model to the end (or to cfg.stop_time) on 'nparts' threads,
+   each owning a share of the entities and its own event queue.  The
+   result is the same for every number of threads.  Returns the number
+   of synchronisation windows used. */
+extern long pdes_run(struct flows *m, int nparts);
+
+#endif
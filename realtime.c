@@ -0,0 +1,558 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "emulator.h"
+#include "rng.h"
+#include "flows.h"
+#include "workload.h"
+#include "realtime.h"
+
+/* ******************************************************************
+   Real-time emulation.  One thread runs both entities and the channel:
+   an epoll loop over a timerfd, armed for the earliest pending packet
+   arrival or timer interrupt, and an eventfd the application threads
+   signal when they hand a message down.  Pending events are kept in
+   the multi-flow model's event heap, with the channel of flow 0
+   (keyed numbers, streams 1 and 2), so a packet is lost, corrupted
+   and delayed exactly as in a keyed run; what the protocol sees as the
+   time is the wall clock, so a slow protocol falls behind and the
+   events it handles late show it.
+
+   The protocol routines are not reentrant, so the application threads
+   never call A_output() themselves: they queue the message, stamped
+   with the time they handed it down, and the loop passes it on.
+**********************************************************************/
+
+#define RT_STREAM 0xa770000000000000ULL  /* application threads' arrivals */
+
+struct rt {
+  const struct protocol *proto;
+  struct simconfig cfg;
+  double scale;                 /* seconds per time unit */
+  struct timespec t0;
+  struct rtresult *res;
+  void *ctx[2];
+  struct host host;
+  double now;                   /* simulated time of the routine running */
+  long long fed;                /* messages handed down by feed() */
+
+  /* the channel and the timers */
+  struct evbuf heap;
+  uint64_t seq;
+  uint64_t key[2];              /* channel stream of each direction */
+  uint64_t ntx[2];
+  double lastarrival[2];
+  int timeron[2];
+  uint64_t timerseq[2];         /* seq of the running timer's event */
+
+  double latency_sum;
+  double late_sum;
+};
+
+/* the monotonic clock 'seconds' after t0 */
+static struct timespec after(const struct timespec *t0, double seconds)
+{
+  struct timespec w = *t0;
+  long long ns = (long long)(seconds * 1e9);
+
+  w.tv_sec += ns / 1000000000;
+  w.tv_nsec += ns % 1000000000;
+  if (w.tv_nsec >= 1000000000) {
+    w.tv_sec++;
+    w.tv_nsec -= 1000000000;
+  }
+  return w;
+}
+
+/* the monotonic clock at simulated time t */
+static struct timespec walltime(const struct rt *rt, double t)
+{
+  return after(&rt->t0, t * rt->scale);
+}
+
+static void schedule(struct rt *rt, struct fevent *ev, int src)
+{
+  ev->src = src;
+  ev->seq = rt->seq++;
+  evheap_insert(&rt->heap, ev);
+}
+
+/*************************** the host ******************************/
+
+static void rt_tolayer3(void *eng, int AorB, struct pkt packet)
+{
+  struct rt *rt = eng;
+  struct fevent ev;
+  double delay;
+  int corrupted;
+
+  rt->res->ntolayer3++;
+  delay = channel_fate(&rt->cfg, rt->key[AorB], rt->ntx[AorB]++, AorB, &packet, &corrupted);
+  if (delay == CHANNEL_LOST) {
+    rt->res->nlost++;
+    return;
+  }
+  rt->res->ncorrupt += corrupted;
+  /* the channel does not reorder: arrive after the last packet sent */
+  ev.time = (rt->lastarrival[AorB] > rt->now ? rt->lastarrival[AorB] : rt->now) + delay;
+  rt->lastarrival[AorB] = ev.time;
+  ev.dst = !AorB;
+  ev.type = FEV_PACKET;
+  ev.gen = 0;
+  ev.pkt = packet;
+  schedule(rt, &ev, AorB);
+}
+
+static void rt_tolayer5(void *eng, int AorB, char datasent[20])
+{
+  struct rt *rt = eng;
+  double latency;
+
+  if (AorB != B)
+    return;
+  rt->res->delivered++;
+  latency = rt_latency(&rt->t0, datasent);
+  rt->latency_sum += latency;
+  if (latency > rt->res->latency_max)
+    rt->res->latency_max = latency;
+}
+
+static void rt_starttimer(void *eng, int AorB, double increment)
+{
+  struct rt *rt = eng;
+  struct fevent ev;
+
+  if (rt->timeron[AorB]) {
+    if (TRACE>=0)
+      printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  rt->timeron[AorB] = 1;
+  ev.time = rt->now + increment;
+  ev.dst = AorB;
+  ev.type = FEV_TIMER;
+  ev.gen = 0;
+  rt->timerseq[AorB] = rt->seq;
+  schedule(rt, &ev, AorB);
+}
+
+static void rt_stoptimer(void *eng, int AorB)
+{
+  struct rt *rt = eng;
+
+  if (!rt->timeron[AorB]) {
+    if (TRACE>=0)
+      printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  rt->timeron[AorB] = 0;
+  evheap_remove(&rt->heap, AorB, rt->timerseq[AorB]);
+}
+
+static const struct hostops rtops = {
+  rt_tolayer3, rt_tolayer5, rt_starttimer, rt_stoptimer
+};
+
+/*************************** the application ******************************/
+
+/* messages handed down by the application threads */
+struct rtqueue {
+  struct msg *m;
+  long long n, size;
+};
+
+struct producer {
+  struct rtapp *app;
+  int t;                        /* thread number */
+  long long i;                  /* message of the workload drawn last */
+};
+
+struct rtapp {
+  struct simconfig cfg;
+  uint64_t key;                 /* the workload's draws */
+  double scale;
+  struct timespec t0;
+  pthread_mutex_t lock;
+  struct rtqueue in;            /* filled by the threads */
+  struct rtqueue out;           /* last taken by rtapp_take() */
+  int producing;                /* threads still handing messages down */
+  int efd;
+  int threads;
+  pthread_t *tid;
+  struct producer *prod;
+};
+
+double rt_since(const struct timespec *t0)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - t0->tv_sec) + 1e-9 * (t.tv_nsec - t0->tv_nsec);
+}
+
+void rt_message(struct msg *m, long long i, double handed)
+{
+  int j;
+
+  for (j=0; j<RT_STAMP; j++)
+    m->data[j] = 97 + i % 26;
+  memcpy(&m->data[RT_STAMP], &handed, sizeof(double));
+}
+
+double rt_latency(const struct timespec *t0, const char data[20])
+{
+  double handed;
+
+  memcpy(&handed, &data[RT_STAMP], sizeof(double));
+  return rt_since(t0) - handed;
+}
+
+static void wake(int efd)
+{
+  uint64_t one = 1;
+
+  if (write(efd, &one, sizeof(one)) != sizeof(one)) {
+    printf("cannot signal the real-time loop: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+static double producerdraw(void *arg, int which)
+{
+  struct producer *p = arg;
+
+  return rng_uniform(p->app->key, (uint64_t)p->i * CHANNEL_DRAWS + which);
+}
+
+/* An application thread: hand its messages down at the workload's
+   times.  There is one arrival process whatever the number of threads:
+   every thread draws all of it, keyed on the message number, and
+   hands down every threads-th message, so thread t takes messages t,
+   t+threads, ... at the times the workload gave them. */
+static void *produce(void *arg)
+{
+  struct producer *p = arg;
+  struct rtapp *app = p->app;
+  struct wlstate wl;
+  struct timespec due;
+  struct msg m;
+  double t = 0.0, gap;
+
+  workload_init(&wl);
+  for (p->i = 0; p->i < app->cfg.nsimmax; p->i++) {
+    if ((gap = workload_gap(&app->cfg, &wl, t, producerdraw, p)) == WL_END)
+      break;
+    t += gap;
+    if (p->i % app->threads != p->t)
+      continue;
+    due = after(&app->t0, t * app->scale);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+      ;
+    rt_message(&m, p->i, rt_since(&app->t0));
+
+    pthread_mutex_lock(&app->lock);
+    if (app->in.n == app->in.size) {
+      app->in.size = app->in.size ? 2 * app->in.size : 64;
+      app->in.m = realloc(app->in.m, app->in.size * sizeof(struct msg));
+      if (app->in.m == NULL) {
+        printf("memory allocation for handed down messages failed.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    app->in.m[app->in.n++] = m;
+    pthread_mutex_unlock(&app->lock);
+    wake(app->efd);
+  }
+  pthread_mutex_lock(&app->lock);
+  app->producing--;
+  pthread_mutex_unlock(&app->lock);
+  wake(app->efd);
+  return NULL;
+}
+
+struct rtapp *rtapp_start(const struct simconfig *cfg, double scale,
+                          const struct timespec *t0, int threads)
+{
+  struct rtapp *app = calloc(1, sizeof(struct rtapp));
+  int t;
+
+  if (cfg->workload == WL_GREEDY)
+    threads = 0;
+  if (app == NULL || (app->prod = calloc(threads + 1, sizeof(struct producer))) == NULL ||
+      (app->tid = calloc(threads + 1, sizeof(pthread_t))) == NULL) {
+    printf("memory allocation for application threads failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  app->cfg = *cfg;
+  app->key = rng_key(cfg->seed, RT_STREAM);
+  app->scale = scale;
+  app->t0 = *t0;
+  app->threads = threads;
+  app->producing = threads;
+  pthread_mutex_init(&app->lock, NULL);
+  if ((app->efd = eventfd(0, EFD_NONBLOCK)) < 0) {
+    printf("cannot create an eventfd: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  for (t = 0; t < threads; t++) {
+    app->prod[t].app = app;
+    app->prod[t].t = t;
+    if (pthread_create(&app->tid[t], NULL, produce, &app->prod[t]) != 0) {
+      printf("cannot start application thread %d\n", t);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return app;
+}
+
+int rtapp_fd(const struct rtapp *app)
+{
+  return app->efd;
+}
+
+int rtapp_take(struct rtapp *app, struct msg **m, long long *n)
+{
+  struct rtqueue t;
+  uint64_t count;
+  int done;
+
+  while (read(app->efd, &count, sizeof(count)) > 0)
+    ;
+  pthread_mutex_lock(&app->lock);
+  t = app->in;
+  app->in = app->out;
+  app->in.n = 0;
+  done = app->producing == 0;
+  pthread_mutex_unlock(&app->lock);
+  app->out = t;
+  *m = t.m;
+  *n = t.n;
+  return done;
+}
+
+void rtapp_stop(struct rtapp *app)
+{
+  int t;
+
+  /* a stop condition can leave threads still handing messages down */
+  for (t = 0; t < app->threads; t++)
+    pthread_cancel(app->tid[t]);
+  for (t = 0; t < app->threads; t++)
+    pthread_join(app->tid[t], NULL);
+  close(app->efd);
+  pthread_mutex_destroy(&app->lock);
+  free(app->in.m);
+  free(app->out.m);
+  free(app->prod);
+  free(app->tid);
+  free(app);
+}
+
+/*************************** the loop ******************************/
+
+static void offer(struct rt *rt, struct msg m)
+{
+  rt->res->offered++;
+  rt->proto->A_output(rt->ctx[A], m);
+}
+
+long long rt_feed(const struct protocol *proto, void *ctx, struct protostats *stats,
+                  long long *fed, long long nsimmax, const struct timespec *t0)
+{
+  long long taken = 0;
+  struct msg m;
+
+  while (*fed < nsimmax) {
+    rt_message(&m, *fed, rt_since(t0));
+    if (!greedy_offer(proto, ctx, m, stats))
+      break;
+    (*fed)++;
+    taken++;
+  }
+  return taken;
+}
+
+/* the greedy workload (see rt_feed()) */
+static void feed(struct rt *rt)
+{
+  rt->res->offered += rt_feed(rt->proto, rt->ctx[A], &rt->res->stats, &rt->fed,
+                              rt->cfg.nsimmax, &rt->t0);
+}
+
+/* handle the events that have fallen due by simulated time 'now' */
+static void fire(struct rt *rt)
+{
+  const struct protocol *p = rt->proto;
+  struct fevent ev;
+  double late;
+
+  while (rt->heap.n > 0 && rt->heap.ev[0].time <= rt->now) {
+    ev = evheap_pop(&rt->heap);
+    late = (rt->now - ev.time) * rt->scale;
+    rt->late_sum += late;
+    if (late > rt->res->late_max)
+      rt->res->late_max = late;
+    rt->res->events++;
+    if (ev.type == FEV_TIMER) {
+      rt->timeron[ev.dst] = 0;
+      if (ev.dst == A)
+        p->A_timerinterrupt(rt->ctx[A]);
+      else
+        p->B_timerinterrupt(rt->ctx[B]);
+    }
+    else if (ev.dst == A)
+      p->A_input(rt->ctx[A], ev.pkt);
+    else
+      p->B_input(rt->ctx[B], ev.pkt);
+    if (ev.dst == A && rt->cfg.workload == WL_GREEDY)
+      feed(rt);
+  }
+}
+
+void realtime_run(const struct protocol *proto, const struct simconfig *cfg,
+                  double scale, int threads, struct rtresult *res)
+{
+  struct host *prevhost = curhost;
+  struct rtapp *app;
+  struct rt rt;
+  struct msg *m;
+  struct itimerspec arm;
+  struct epoll_event ev, fired[2];
+  struct timespec cpu0, cpu1;
+  long long i, n;
+  double wakeat;
+  int tfd, ep, timeout, done;
+  uint64_t count;
+
+  memset(res, 0, sizeof(*res));
+  memset(&rt, 0, sizeof(rt));
+  rt.proto = proto;
+  rt.cfg = *cfg;
+  rt.scale = scale;
+  rt.res = res;
+  rt.host.ops = &rtops;
+  rt.host.eng = &rt;
+  rt.host.stats = &res->stats;
+  rt.key[A] = rng_key(cfg->seed, 1);
+  rt.key[B] = rng_key(cfg->seed, 2);
+  rt.ctx[A] = calloc(1, proto->A_size ? proto->A_size : 1);
+  rt.ctx[B] = calloc(1, proto->B_size ? proto->B_size : 1);
+  if (rt.ctx[A] == NULL || rt.ctx[B] == NULL) {
+    printf("memory allocation for protocol state failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  ep = epoll_create1(0);
+  if (tfd < 0 || ep < 0) {
+    printf("cannot set up the real-time loop: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  curhost = &rt.host;
+  proto->A_init(rt.ctx[A]);
+  proto->B_init(rt.ctx[B]);
+
+  clock_gettime(CLOCK_MONOTONIC, &rt.t0);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+  app = rtapp_start(cfg, scale, &rt.t0, threads);
+  ev.events = EPOLLIN;
+  ev.data.fd = rtapp_fd(app);
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, rtapp_fd(app), &ev) < 0) {
+    printf("cannot set up the real-time loop: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  ev.data.fd = tfd;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+    printf("cannot set up the real-time loop: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (cfg->workload == WL_GREEDY)
+    feed(&rt);
+
+  for (;;) {
+    rt.now = rt_since(&rt.t0) / scale;
+    if (cfg->stop_time > 0 && rt.now >= cfg->stop_time) {
+      res->stopreason = STOP_TIME;
+      break;
+    }
+    if (cfg->wall_budget > 0 && rt.now * scale >= cfg->wall_budget) {
+      res->stopreason = STOP_WALL;
+      break;
+    }
+    done = rtapp_take(app, &m, &n);
+    for (i = 0; i < n; i++)
+      offer(&rt, m[i]);
+    fire(&rt);
+    if (done && rt.heap.n == 0) {
+      res->stopreason = STOP_DRAINED;
+      break;
+    }
+
+    /* sleep until the next event falls due, the run is to stop or a
+       message comes */
+    memset(&arm, 0, sizeof(arm));
+    if (rt.heap.n > 0 || cfg->stop_time > 0) {
+      wakeat = rt.heap.n > 0 ? rt.heap.ev[0].time : cfg->stop_time;
+      if (cfg->stop_time > 0 && cfg->stop_time < wakeat)
+        wakeat = cfg->stop_time;
+      arm.it_value = walltime(&rt, wakeat);
+      if (arm.it_value.tv_sec == 0 && arm.it_value.tv_nsec == 0)
+        arm.it_value.tv_nsec = 1;       /* zero would disarm it */
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &arm, NULL);
+    timeout = -1;
+    if (cfg->wall_budget > 0) {
+      timeout = 1 + (int)(1000 * (cfg->wall_budget - rt_since(&rt.t0)));
+      if (timeout < 0)
+        timeout = 0;
+    }
+    if (epoll_wait(ep, fired, 2, timeout) < 0 && errno != EINTR) {
+      printf("real-time loop: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    while (read(tfd, &count, sizeof(count)) > 0)
+      ;
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+  res->time = rt.now;
+  res->wall = rt_since(&rt.t0);
+  res->cpu = (cpu1.tv_sec - cpu0.tv_sec) + 1e-9 * (cpu1.tv_nsec - cpu0.tv_nsec);
+  res->latency_avg = res->delivered ? rt.latency_sum / res->delivered : 0.0;
+  res->late_avg = res->events ? rt.late_sum / res->events : 0.0;
+  curhost = prevhost;
+
+  rtapp_stop(app);
+  close(ep);
+  close(tfd);
+  free(rt.heap.ev);
+  free(rt.ctx[A]);
+  free(rt.ctx[B]);
+}
+
+void realtime_report(const struct protocol *proto, const struct rtresult *res)
+{
+  printf("%s ran in real time to simulated time %f in %.3f s (%s)\n", proto->name,
+         res->time, res->wall, stopreasons[res->stopreason]);
+  printf("messages handed down by the application:  %lld \n", res->offered);
+  printf("number of messages dropped due to full window:  %lld \n", res->stats.window_full);
+  printf("messages delivered to application:  %lld \n", res->delivered);
+  printf("packets sent into layer 3:  %lld (%lld lost, %lld corrupted)\n",
+         res->ntolayer3, res->nlost, res->ncorrupt);
+  printf("packet resends by A:  %lld \n", res->stats.packets_resent);
+  printf("delivery latency:  mean %.6f s, max %.6f s\n", res->latency_avg, res->latency_max);
+  printf("events handled late by:  mean %.6f s, max %.6f s\n", res->late_avg, res->late_max);
+  printf("packets per second:  %.0f \n", res->wall > 0 ? res->ntolayer3 / res->wall : 0.0);
+  if (res->sends > 0)
+    printf("packets per send call:  %.2f \n",
+           (double)(res->ntolayer3 - res->nlost) / res->sends);
+  printf("CPU time of the protocol:  %.3f s (%.2f us per message, %.2f us per packet)\n",
+         res->cpu, res->offered ? 1e6 * res->cpu / res->offered : 0.0,
+         res->ntolayer3 ? 1e6 * res->cpu / res->ntolayer3 : 0.0);
+}
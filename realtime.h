@@ -0,0 +1,74 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <time.h>
+#include "emulator.h"
+
+/* ******************************************************************
+   Real-time emulation: the protocol runs against the wall clock.
+   Simulated time is CLOCK_MONOTONIC since the start divided by a scale
+   (seconds per time unit), packets and timers fire when the clock
+   reaches them, and messages come from application threads that hand
+   them down at the workload's times as they fall due (or, with the
+   greedy workload, whenever the sender's window has room).
+**********************************************************************/
+
+/* what a real-time run measured */
+struct rtresult {
+  int stopreason;               /* STOP_DRAINED, STOP_TIME or STOP_WALL */
+  long long offered;            /* messages handed down to A */
+  long long delivered;          /* messages delivered to layer 5 at B */
+  long long ntolayer3, nlost, ncorrupt;
+  long long events;             /* packet arrivals and timer interrupts */
+  long long sends;              /* system calls that sent packets (UDP) */
+  double time;                  /* simulated time at the end */
+  double wall;                  /* seconds the run took */
+  double cpu;                   /* CPU seconds of the threads running the protocol */
+  double latency_avg, latency_max;  /* seconds from hand-down to delivery */
+  double late_avg, late_max;    /* seconds events fired after their time */
+  struct protostats stats;
+};
+
+/* Run proto in real time with cfg (nsimmax messages from cfg's
+   workload, channel from keyed numbers under cfg->seed), one simulated
+   time unit lasting 'scale' seconds, the messages handed down by
+   'threads' application threads.  The protocol itself runs on the
+   calling thread. */
+extern void realtime_run(const struct protocol *proto, const struct simconfig *cfg,
+                         double scale, int threads, struct rtresult *res);
+extern void realtime_report(const struct protocol *proto, const struct rtresult *res);
+
+/* The application side, shared by the real-time backends.  A message
+   carries the time it was handed down in its last bytes, so whoever
+   delivers it can tell its latency without asking the sender. */
+
+#define RT_STAMP 12             /* offset of the stamp in msg.data */
+
+struct rtapp;
+
+/* start the application threads (none for the greedy workload); t0 is
+   the start of the run */
+extern struct rtapp *rtapp_start(const struct simconfig *cfg, double scale,
+                                 const struct timespec *t0, int threads);
+/* descriptor that is readable when messages are waiting */
+extern int rtapp_fd(const struct rtapp *app);
+/* The messages handed down since the last call: *n of them at *m,
+   valid until the next call.  Returns 1 once no more will come. */
+extern int rtapp_take(struct rtapp *app, struct msg **m, long long *n);
+/* stop the threads, if still running, and free app */
+extern void rtapp_stop(struct rtapp *app);
+
+/* The greedy workload: hand A (context ctx, counting into stats)
+   messages *fed onwards, stamped, until it refuses one or nsimmax are
+   out (see greedy_offer()).  Returns how many it took. */
+extern long long rt_feed(const struct protocol *proto, void *ctx, struct protostats *stats,
+                         long long *fed, long long nsimmax, const struct timespec *t0);
+
+/* seconds since t0 */
+extern double rt_since(const struct timespec *t0);
+/* message number i, handed down at 'handed' seconds */
+extern void rt_message(struct msg *m, long long i, double handed);
+/* seconds from the hand-down of a delivered message until now */
+extern double rt_latency(const struct timespec *t0, const char data[20]);
+
+#endif
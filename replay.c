@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "emulator.h"
+#include "replay.h"
+
+/* ******************************************************************
+   Replay.  The log holds every call the emulator made into the
+   protocol, so making the same calls in the same order takes the
+   protocol through exactly the states it went through, as long as it
+   depends on nothing else.  Its own calls out (tolayer3(), tolayer5(),
+   the timers) are only counted: what they led to is already in the
+   log.  Without the channel, the event list and the random numbers a
+   rare failure can be stepped through in a debugger, or the protocol
+   profiled alone, at a fraction of the cost of the run.
+**********************************************************************/
+
+struct player {
+  struct replayresult *res;
+};
+
+static void rp_tolayer3(void *eng, int AorB, struct pkt packet)
+{
+  struct player *pl = eng;
+
+  pl->res->tolayer3++;
+}
+
+static void rp_tolayer5(void *eng, int AorB, char datasent[20])
+{
+  struct player *pl = eng;
+
+  pl->res->delivered++;
+}
+
+static void rp_starttimer(void *eng, int AorB, double increment)
+{
+}
+
+static void rp_stoptimer(void *eng, int AorB)
+{
+}
+
+static const struct hostops replayops = {
+  rp_tolayer3, rp_tolayer5, rp_starttimer, rp_stoptimer
+};
+
+/* the whole log, read up front so the replay itself does no I/O */
+static struct record *readlog(FILE *log, long long *n)
+{
+  struct record *rec = NULL, *p;
+  long long size = 0;
+
+  *n = 0;
+  for (;;) {
+    if (*n == size) {
+      size = size ? 2 * size : 1024;
+      p = realloc(rec, size * sizeof(struct record));
+      if (p == NULL) {
+        printf("memory allocation for the replay log failed.\n");
+        exit(EXIT_FAILURE);
+      }
+      rec = p;
+    }
+    if (fread(&rec[*n], sizeof(struct record), 1, log) != 1)
+      return rec;
+    (*n)++;
+  }
+}
+
+int replay_run(const struct protocol *proto, FILE *log, struct replayresult *res)
+{
+  struct host *prevhost = curhost;
+  struct recheader h;
+  struct player pl;
+  struct host host;
+  struct record *rec, *r;
+  struct timespec t0, t1;
+  struct msg message;
+  void *ctx[2];
+  long long n, i, dropped = 0, refused = 0;
+
+  if (fread(&h, sizeof(h), 1, log) != 1 || memcmp(h.magic, REC_MAGIC, sizeof(h.magic)) != 0) {
+    printf("not a protocol call log\n");
+    return -1;
+  }
+  if (strncmp(h.proto, proto->name, sizeof(h.proto)) != 0) {
+    printf("the log is of protocol %.31s, not %s\n", h.proto, proto->name);
+    return -1;
+  }
+  rec = readlog(log, &n);
+
+  memset(res, 0, sizeof(*res));
+  pl.res = res;
+  host.ops = &replayops;
+  host.eng = &pl;
+  host.stats = &res->stats;
+  ctx[A] = calloc(1, proto->A_size ? proto->A_size : 1);
+  ctx[B] = calloc(1, proto->B_size ? proto->B_size : 1);
+  if (ctx[A] == NULL || ctx[B] == NULL) {
+    printf("memory allocation for protocol state failed.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  curhost = &host;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < n; i++) {
+    r = &rec[i];
+    switch (r->type) {
+    case REC_INIT:
+      if (r->entity == A)
+        proto->A_init(ctx[A]);
+      else
+        proto->B_init(ctx[B]);
+      break;
+    case REC_OUTPUT:
+      dropped = res->stats.window_full;
+      memcpy(message.data, r->pkt.payload, sizeof(message.data));
+      if (r->entity == A)
+        proto->A_output(ctx[A], message);
+      else
+        proto->B_output(ctx[B], message);
+      break;
+    case REC_REFUSED:
+      res->stats.window_full = dropped;
+      refused++;
+      break;
+    case REC_INPUT:
+      if (r->entity == A)
+        proto->A_input(ctx[A], r->pkt);
+      else
+        proto->B_input(ctx[B], r->pkt);
+      break;
+    case REC_TIMER:
+      if (r->entity == A)
+        proto->A_timerinterrupt(ctx[A]);
+      else
+        proto->B_timerinterrupt(ctx[B]);
+      break;
+    default:
+      printf("INTERNAL PANIC: unknown record type %d\n", r->type);
+      exit(EXIT_FAILURE);
+    }
+    res->time = r->time;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  curhost = prevhost;
+  res->calls = n - refused;
+  res->seconds = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+
+  free(ctx[A]);
+  free(ctx[B]);
+  free(rec);
+  return 0;
+}
+
+void replay_report(const struct protocol *proto, const struct replayresult *res)
+{
+  printf("replayed %lld calls into %s up to time %f in %.3f s\n", res->calls,
+         proto->name, res->time, res->seconds);
+  printf("packets sent into layer 3:  %lld \n", res->tolayer3);
+  printf("number of messages dropped due to full window:  %lld \n", res->stats.window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %lld \n", res->stats.new_ACKs);
+  printf("number of packet resends by A:  %lld \n", res->stats.packets_resent);
+  printf("number of correct packets received at B:  %lld \n", res->stats.packets_received);
+  printf("number of messages delivered to application:  %lld \n", res->delivered);
+}
@@ -0,0 +1,52 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include "emulator.h"
+
+/* ******************************************************************
+   Recording and replay of the calls a simulation makes into its
+   protocol.  A log (see sim_record()) is a header followed by one
+   record per call, in the order they were made.
+**********************************************************************/
+
+#define REC_MAGIC "rtrec01"
+
+/* record types: the protocol routine called */
+#define REC_INIT    0           /* A_init or B_init */
+#define REC_OUTPUT  1           /* A_output or B_output: message in pkt.payload */
+#define REC_INPUT   2           /* A_input or B_input: packet in pkt */
+#define REC_TIMER   3           /* A_timerinterrupt or B_timerinterrupt */
+#define REC_REFUSED 4           /* not a call: the A_output before it refused a
+                                   greedy message, which is not counted as
+                                   dropped (see WL_GREEDY) */
+
+struct recheader {
+  char magic[8];
+  char proto[32];               /* name of the protocol */
+};
+
+struct record {
+  double time;                  /* simulated time of the call */
+  int type;                     /* REC_... */
+  int entity;                   /* A or B */
+  struct pkt pkt;
+};
+
+/* what a replay did */
+struct replayresult {
+  long long calls;              /* protocol routines called */
+  long long tolayer3;           /* packets the protocol sent */
+  long long delivered;          /* messages it delivered to layer 5 */
+  double time;                  /* simulated time of the last call */
+  double seconds;               /* wall-clock time of the calls */
+  struct protostats stats;
+};
+
+/* Make the calls recorded in 'log' into protocol proto, with nothing
+   of the emulator in between.  Returns 0, or -1 (having said why) if
+   the log is not a log of proto. */
+extern int replay_run(const struct protocol *proto, FILE *log, struct replayresult *res);
+extern void replay_report(const struct protocol *proto, const struct replayresult *res);
+
+#endif
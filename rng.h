@@ -0,0 +1,69 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <math.h>
+
+/* ******************************************************************
+   Counter-based random numbers.
+
+   A draw is a pure function of a stream key and an index: the index-th
+   output of SplitMix64 started from the key.  There is no hidden state,
+   so two simulations that use the same key and index see the same
+   number no matter what else they did in between (common random
+   numbers), a stream can be replayed or skipped ahead, and saving a
+   stream means saving a counter.
+**********************************************************************/
+
+#define RNG_GOLDEN 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t rng_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* key of stream number 'stream' under seed 'seed' */
+static inline uint64_t rng_key(uint64_t seed, uint64_t stream)
+{
+  return rng_mix(rng_mix(seed + RNG_GOLDEN) ^ (stream * RNG_GOLDEN));
+}
+
+/* the 53 bits behind the index-th number of a stream */
+static inline uint64_t rng_bits(uint64_t key, uint64_t index)
+{
+  return rng_mix(key + (index + 1) * RNG_GOLDEN) >> 11;
+}
+
+/* the index-th number of a stream, uniform on [0,1) */
+static inline double rng_uniform(uint64_t key, uint64_t index)
+{
+  return rng_bits(key, index) * 0x1.0p-53;
+}
+
+/* the t for which rng_bits(...) < t exactly when rng_uniform(...) < p:
+   tests of a draw against a fixed probability as integer compares, which
+   unlike floating-point ones the compiler may turn into branch-free SIMD
+   code */
+static inline uint64_t rng_threshold(double p)
+{
+  if (p <= 0)
+    return 0;
+  if (p >= 1)
+    return 1ULL << 53;
+  return (uint64_t)ceil(p * 0x1.0p53);
+}
+
+/* numbers first .. first+n-1 of a stream, in one pass the compiler can
+   vectorise */
+static inline void rng_fill(uint64_t key, uint64_t first, double *u, int n)
+{
+  int i;
+
+#pragma omp simd
+  for (i = 0; i < n; i++)
+    u[i] = rng_uniform(key, first + i);
+}
+
+#endif
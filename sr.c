@@ -34,7 +34,7 @@
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+static int ComputeChecksum(struct pkt packet)
 {
   int checksum = 0;
   int i;
@@ -47,7 +47,7 @@ int ComputeChecksum(struct pkt packet)
   return checksum;
 }
 
-int IsCorrupted(struct pkt packet)
+static int IsCorrupted(struct pkt packet)
 {
   if (packet.checksum == ComputeChecksum(packet))
     return (0);
@@ -57,37 +57,40 @@ int IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE]; /* array for storing packets waiting for ACK */
-static int timers[WINDOWSIZE];        /* array for tracking which timers are active */
-static int acked[WINDOWSIZE];        /* array for tracking which packets are ACKed */
-static int windowfirst, windowlast;     /* array indexes of the first/last packet in window */
-static int windowcount;               /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;              /* the next sequence number to be used by the sender */
+struct sender {
+  struct pkt buffer[WINDOWSIZE]; /* array for storing packets waiting for ACK */
+  int timers[WINDOWSIZE];        /* array for tracking which timers are active */
+  int acked[WINDOWSIZE];        /* array for tracking which packets are ACKed */
+  int windowfirst, windowlast;     /* array indexes of the first/last packet in window */
+  int windowcount;               /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;              /* the next sequence number to be used by the sender */
+};
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+static void A_output(void *ctx, struct msg message)
 {
+  struct sender *s = ctx;
   struct pkt sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if (windowcount < WINDOWSIZE)
+  if (s->windowcount < WINDOWSIZE)
   {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = s->A_nextseqnum;
     sendpkt.acknum = NOTINUSE;
     for (i = 0; i < 20; i++)
       sendpkt.payload[i] = message.data[i];
     sendpkt.checksum = ComputeChecksum(sendpkt);
 
     /* put packet in window buffer */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    acked[windowlast] = 0; /* track packet status */
-    windowcount++;
+    s->windowlast = (s->windowlast + 1) % WINDOWSIZE;
+    s->buffer[s->windowlast] = sendpkt;
+    s->acked[s->windowlast] = 0; /* track packet status */
+    s->windowcount++;
 
     /* send out packet */
     if (TRACE > 0)
@@ -95,28 +98,29 @@ void A_output(struct msg message)
     tolayer3(A, sendpkt);
 
     /* start timer if first packet in window */
-    if (windowcount == 1){
+    if (s->windowcount == 1){
       starttimer(A, RTT); /* start timer for the first packet in window */
-      timers[windowlast] = 1;
+      s->timers[s->windowlast] = 1;
     }
     
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    s->A_nextseqnum = (s->A_nextseqnum + 1) % SEQSPACE;
   }
   /* if blocked,  window is full */
   else
   {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    stats()->window_full++;
   }
 }
 
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+static void A_input(void *ctx, struct pkt packet)
 {
+  struct sender *s = ctx;
   int i;
   int found = 0; 
 
@@ -125,39 +129,39 @@ void A_input(struct pkt packet)
   {
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
+    stats()->total_ACKs_received++;
 
-    if (windowcount != 0) {
+    if (s->windowcount != 0) {
       /* find the packet in window */
-      for (i = 0; i < windowcount; i++) {
-        int slot = (windowfirst + i) % WINDOWSIZE;
-        if (buffer[slot].seqnum == packet.acknum && !acked[slot]) {
-          acked[slot] = 1;
+      for (i = 0; i < s->windowcount; i++) {
+        int slot = (s->windowfirst + i) % WINDOWSIZE;
+        if (s->buffer[slot].seqnum == packet.acknum && !s->acked[slot]) {
+          s->acked[slot] = 1;
           found = 1;
           /* packet is a new ACK */
           if (TRACE > 0)
             printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-          new_ACKs++;
+          stats()->new_ACKs++;
 
           /* stop timer if this is the first packet in window */
-          if (slot == windowfirst) {
+          if (slot == s->windowfirst) {
             stoptimer(A);
-            timers[slot] = 0;
+            s->timers[slot] = 0;
           }
 
-          while (windowcount > 0 && acked[windowfirst]) {
-            acked[windowfirst] = 0;
-            timers[windowfirst] = 0;
-            windowfirst = (windowfirst + 1) % WINDOWSIZE;
-            windowcount--;
+          while (s->windowcount > 0 && s->acked[s->windowfirst]) {
+            s->acked[s->windowfirst] = 0;
+            s->timers[s->windowfirst] = 0;
+            s->windowfirst = (s->windowfirst + 1) % WINDOWSIZE;
+            s->windowcount--;
           }
 
-          if (windowcount > 0) {
+          if (s->windowcount > 0) {
             for (int i = 0; i < WINDOWSIZE; i++) {
-              int slot = (windowfirst + i) % WINDOWSIZE;
-              if (!acked[slot]) {
+              int slot = (s->windowfirst + i) % WINDOWSIZE;
+              if (!s->acked[slot]) {
                 starttimer(A, RTT);
-                timers[slot] = 1;
+                s->timers[slot] = 1;
                 break;
               }
             }
@@ -174,23 +178,24 @@ void A_input(struct pkt packet)
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+static void A_timerinterrupt(void *ctx)
 {
+  struct sender *s = ctx;
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
   for (int i = 0; i < WINDOWSIZE; i++) {
-    int slot = (windowfirst + i) % WINDOWSIZE;
-    if (!acked[slot]) {
+    int slot = (s->windowfirst + i) % WINDOWSIZE;
+    if (!s->acked[slot]) {
       /* resend the packet */
       if (TRACE > 0)
-        printf("Sending packet %d to layer 3\n", buffer[slot].seqnum);
-      tolayer3(A, buffer[slot]);
-      packets_resent++;
+        printf("Sending packet %d to layer 3\n", s->buffer[slot].seqnum);
+      tolayer3(A, s->buffer[slot]);
+      stats()->packets_resent++;
       starttimer(A, RTT);
-      timers[slot] = 1;  
+      s->timers[slot] = 1;  
       break;
     }
   }
@@ -198,53 +203,57 @@ void A_timerinterrupt(void)
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+static void A_init(void *ctx)
 {
+  struct sender *s = ctx;
   int i;
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
-  windowfirst = 0; 
-  windowlast = -1; 
-  windowcount = 0;
+  s->A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
+  s->windowfirst = 0; 
+  s->windowlast = -1; 
+  s->windowcount = 0;
   /* initialize all packet_status entries to indicate they're not in use */
   for (i = 0; i < WINDOWSIZE; i++) {
-    acked[i] = 0; /* initially all slots are available */
-    timers[i] = 0; 
+    s->acked[i] = 0; /* initially all slots are available */
+    s->timers[i] = 0; 
   }  
 }
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int recv_base; /* Base sequence number expected by receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-static struct pkt rcv_buffer[SEQSPACE]; /* buffer for out of order packets */
-static int received[SEQSPACE]; /* track which packets have been received */
+struct receiver {
+  int recv_base; /* Base sequence number expected by receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+  struct pkt rcv_buffer[SEQSPACE]; /* buffer for out of order packets */
+  int received[SEQSPACE]; /* track which packets have been received */
+};
 
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void B_input(void *ctx, struct pkt packet)
 {
+  struct receiver *r = ctx;
   struct pkt sendpkt;
   int i;
 
   /* check if packet is not corrupted */
   if (!IsCorrupted(packet)) {
     /* calculate expected window */
-    int offset = (packet.seqnum - recv_base + SEQSPACE) % SEQSPACE;
+    int offset = (packet.seqnum - r->recv_base + SEQSPACE) % SEQSPACE;
     if (offset < WINDOWSIZE) {
-      if (!received[packet.seqnum]) {
-        received[packet.seqnum] = 1;
-        rcv_buffer[packet.seqnum] = packet;
+      if (!r->received[packet.seqnum]) {
+        r->received[packet.seqnum] = 1;
+        r->rcv_buffer[packet.seqnum] = packet;
         if (TRACE > 0)
           printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-        packets_received++;
+        stats()->packets_received++;
       }
 
       /* deliver in-order packets to layer 5 */
-      while (received[recv_base]) {
-        tolayer5(B, rcv_buffer[recv_base].payload);
-        received[recv_base] = 0;
-        recv_base = (recv_base + 1) % SEQSPACE;
+      while (r->received[r->recv_base]) {
+        tolayer5(B, r->rcv_buffer[r->recv_base].payload);
+        r->received[r->recv_base] = 0;
+        r->recv_base = (r->recv_base + 1) % SEQSPACE;
       }
       /* send ACK for the received packet */
       sendpkt.acknum = packet.seqnum;
@@ -252,16 +261,16 @@ void B_input(struct pkt packet)
       /* packet outside receive window, send ACK anyway */
       if (TRACE > 0)
         printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-      sendpkt.acknum = (recv_base - 1 + SEQSPACE) % SEQSPACE;
+      sendpkt.acknum = (r->recv_base - 1 + SEQSPACE) % SEQSPACE;
     }
   } else {
       if (TRACE > 0)
         printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-      sendpkt.acknum = (recv_base - 1 + SEQSPACE) % SEQSPACE;
+      sendpkt.acknum = (r->recv_base - 1 + SEQSPACE) % SEQSPACE;
     }
 
-    sendpkt.seqnum = B_nextseqnum;
-    B_nextseqnum = (B_nextseqnum + 1) % 2;
+    sendpkt.seqnum = r->B_nextseqnum;
+    r->B_nextseqnum = (r->B_nextseqnum + 1) % 2;
 
     for (i = 0; i < 20; i++)
       sendpkt.payload[i] = '0';
@@ -275,14 +284,15 @@ void B_input(struct pkt packet)
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+static void B_init(void *ctx)
 {
+  struct receiver *r = ctx;
   int i;
-  recv_base = 0;
-  B_nextseqnum = 1;
+  r->recv_base = 0;
+  r->B_nextseqnum = 1;
   /* initialize the receive buffer and packet */
   for (i = 0; i < SEQSPACE; i++) {
-    received[i] = 0; /* mark all buffer slots as empty */
+    r->received[i] = 0; /* mark all buffer slots as empty */
   }
 }
 
@@ -291,11 +301,17 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+static void B_output(void *ctx, struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+static void B_timerinterrupt(void *ctx)
 {
 }
+
+const struct protocol sr_protocol = {
+  "sr", sizeof(struct sender), sizeof(struct receiver),
+  A_init, A_output, A_input, A_timerinterrupt,
+  B_init, B_output, B_input, B_timerinterrupt
+};
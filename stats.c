@@ -0,0 +1,90 @@
+#include <math.h>
+#include "stats.h"
+
+void summary_init(struct summary *s)
+{
+  s->n = 0;
+  s->mean = 0.0;
+  s->m2 = 0.0;
+}
+
+void summary_add(struct summary *s, double x)
+{
+  double delta = x - s->mean;
+
+  s->n++;
+  s->mean += delta / s->n;
+  s->m2 += delta * (x - s->mean);
+}
+
+double summary_sd(const struct summary *s)
+{
+  if (s->n < 2)
+    return 0.0;
+  return sqrt(s->m2 / (s->n - 1));
+}
+
+double summary_halfwidth(const struct summary *s, double level)
+{
+  if (s->n < 2)
+    return INFINITY;
+  return t_quantile(1.0 - (1.0 - level) / 2.0, s->n - 1) * summary_sd(s) / sqrt(s->n);
+}
+
+/* inverse of the standard normal distribution (Acklam's rational
+   approximation, relative error below 1.2e-9) */
+double normal_quantile(double p)
+{
+  static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02,
+    -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01,
+    2.506628277459239e+00 };
+  static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02,
+    -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01 };
+  static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01,
+    -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00,
+    2.938163982698783e+00 };
+  static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01,
+    2.445134137142996e+00, 3.754408661907416e+00 };
+  double q, r;
+
+  if (p <= 0.0)
+    return -INFINITY;
+  if (p >= 1.0)
+    return INFINITY;
+  if (p < 0.02425) {
+    q = sqrt(-2 * log(p));
+    return (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+           ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+  }
+  if (p > 1 - 0.02425) {
+    q = sqrt(-2 * log(1 - p));
+    return -(((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+            ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+  }
+  q = p - 0.5;
+  r = q * q;
+  return (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q /
+         (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+}
+
+/* inverse of Student's t distribution with df degrees of freedom.  Exact
+   for one and two degrees of freedom, otherwise the Cornish-Fisher
+   expansion about the normal quantile, good to three decimals from
+   three degrees of freedom on, which is plenty for confidence intervals */
+double t_quantile(double p, long df)
+{
+  double z, z2, v = df;
+
+  if (df < 1)
+    return NAN;
+  if (df == 1)
+    return tan(M_PI * (p - 0.5));
+  if (df == 2)
+    return (2 * p - 1) / sqrt(2 * p * (1 - p));
+  z = normal_quantile(p);
+  z2 = z * z;
+  return z + z * (z2 + 1) / (4 * v)
+    + z * ((5 * z2 + 16) * z2 + 3) / (96 * v * v)
+    + z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * v * v * v)
+    + z * ((((79 * z2 + 776) * z2 + 1482) * z2 - 1920) * z2 - 945) / (92160 * v * v * v * v);
+}
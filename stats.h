@@ -0,0 +1,25 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* ******************************************************************
+   Summary statistics for repeated simulation runs: running mean and
+   variance (Welford) and Student t confidence intervals.
+**********************************************************************/
+
+struct summary {
+  long n;
+  double mean;
+  double m2;                /* sum of squared deviations from the mean */
+};
+
+extern void summary_init(struct summary *s);
+extern void summary_add(struct summary *s, double x);
+extern double summary_sd(const struct summary *s);
+/* half-width of the two-sided confidence interval for the mean, at
+   confidence level 'level' (e.g. 0.95); infinite with fewer than 2 samples */
+extern double summary_halfwidth(const struct summary *s, double level);
+
+extern double normal_quantile(double p);
+extern double t_quantile(double p, long df);
+
+#endif
@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "emulator.h"
+#include "flows.h"
+#include "tw.h"
+
+/* ******************************************************************
+   Time Warp.  Each partition handles its pending events in order
+   without waiting for the others.  Before an event is handled the
+   state of its entity (the entstate and the protocol's context) is
+   saved in the partition's log, together with the events it schedules.
+   When an event arrives from another partition in the past of what has
+   already been handled (a straggler), the partition rolls back: the
+   logged events after it are undone newest first, restoring the saved
+   states, taking back the events they scheduled (anti-messages for
+   those sent to other partitions) and returning them to the pending
+   queue.
+
+   Every TW_BATCH events the partitions stop together, deliver all
+   messages still in flight, and take the earliest pending event time
+   as global virtual time (GVT).  Nothing before GVT can be rolled back
+   any more, so those log entries are freed (fossil collection).  Only
+   events less than TW_WINDOW past GVT are run, which keeps a partition
+   from racing far ahead of the others only to be rolled back.
+
+   The log is kept as three stacks (entries, scheduled events and saved
+   contexts) because undoing always pops the newest entry and fossil
+   collection always removes the oldest ones.
+**********************************************************************/
+
+#define TW_BATCH   1024         /* events per partition between GVT rounds */
+#define TW_WINDOW  5.0          /* how far past GVT events are run */
+#define TW_POLL    32           /* events between looks at the inbox */
+
+struct twmsg {
+  struct fevent ev;
+  int anti;                     /* take back ev instead of delivering it */
+};
+
+struct inbox {
+  pthread_mutex_t lock;
+  struct twmsg *m;
+  int n, size;
+};
+
+struct logent {
+  struct fevent ev;             /* the event handled */
+  struct entstate saved;        /* its entity before */
+  size_t ctxoff;                /* saved protocol context in ctxlog */
+  int sentmark;                 /* events it scheduled start here in sent */
+};
+
+struct twpart {
+  int id;
+  struct tw *eng;
+  struct evbuf pending;         /* heap of events not yet handled */
+  struct logent *log;           /* events handled since GVT, in order */
+  int nlog, logsize;
+  struct evbuf sent;            /* events scheduled by logged events */
+  char *ctxlog;
+  size_t nctx, ctxsize;
+  int logging;                  /* scheduling from a logged event */
+  struct inbox in;
+  struct twmsg *spare;          /* the inbox buffer being drained */
+  int sparesize;
+  struct twstats st;
+};
+
+struct tw {
+  struct flows *model;
+  int nparts;
+  struct twpart *parts;
+  double *mins;
+  pthread_barrier_t barrier;
+  atomic_long inflight;         /* messages sent but not yet received */
+};
+
+static void *xrealloc(void *p, size_t size)
+{
+  if ((p = realloc(p, size)) == NULL) {
+    printf("memory allocation for the Time Warp log failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void send(struct twpart *to, const struct fevent *ev, int anti)
+{
+  struct inbox *in = &to->in;
+
+  atomic_fetch_add(&to->eng->inflight, 1);
+  pthread_mutex_lock(&in->lock);
+  if (in->n == in->size) {
+    in->size = in->size ? 2 * in->size : 64;
+    in->m = xrealloc(in->m, in->size * sizeof(struct twmsg));
+  }
+  in->m[in->n].ev = *ev;
+  in->m[in->n].anti = anti;
+  in->n++;
+  pthread_mutex_unlock(&in->lock);
+}
+
+/* the model's schedule routine: owner is the scheduling entity's partition */
+static void tw_schedule(void *owner, const struct fevent *ev)
+{
+  struct twpart *p = owner;
+  struct twpart *dst = p->eng->model->ent[ev->dst].owner;
+
+  if (p->logging)
+    evbuf_push(&p->sent, ev);
+  if (dst == p)
+    evheap_insert(&p->pending, ev);
+  else
+    send(dst, ev, 0);
+}
+
+/* undo the newest logged event */
+static void undo(struct twpart *p)
+{
+  struct logent *le = &p->log[--p->nlog];
+  struct entity *e = &p->eng->model->ent[le->ev.dst];
+
+  while (p->sent.n > le->sentmark) {
+    struct fevent *s = &p->sent.ev[--p->sent.n];
+    struct twpart *q = p->eng->model->ent[s->dst].owner;
+
+    /* anything it scheduled here comes later, so is already undone */
+    if (q != p) {
+      send(q, s, 1);
+      p->st.antimessages++;
+    }
+    else if (!evheap_remove(&p->pending, s->src, s->seq)) {
+      printf("INTERNAL PANIC: Time Warp lost an event\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  e->st = le->saved;
+  memcpy(e->ctx, p->ctxlog + le->ctxoff, e->ctxsize);
+  p->nctx = le->ctxoff;
+  evheap_insert(&p->pending, &le->ev);
+  p->st.rolledback++;
+}
+
+/* undo every logged event that comes after ev */
+static void rollback(struct twpart *p, const struct fevent *ev)
+{
+  if (p->nlog == 0 || !fevent_before(ev, &p->log[p->nlog - 1].ev))
+    return;
+  p->st.rollbacks++;
+  while (p->nlog > 0 && fevent_before(ev, &p->log[p->nlog - 1].ev))
+    undo(p);
+}
+
+/* take back an event, undoing it first if it was already handled */
+static void annihilate(struct twpart *p, const struct fevent *ev)
+{
+  if (evheap_remove(&p->pending, ev->src, ev->seq))
+    return;
+  p->st.rollbacks++;
+  while (p->nlog > 0) {
+    const struct fevent *top = &p->log[p->nlog - 1].ev;
+    int found = top->src == ev->src && top->seq == ev->seq;
+
+    undo(p);
+    if (found)
+      break;
+  }
+  if (!evheap_remove(&p->pending, ev->src, ev->seq)) {
+    printf("INTERNAL PANIC: Time Warp cannot take back an event\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void drain(struct twpart *p)
+{
+  struct twmsg *m;
+  int n, size, i;
+
+  /* swap buffers, so senders are not held up while we work */
+  pthread_mutex_lock(&p->in.lock);
+  m = p->in.m;
+  n = p->in.n;
+  size = p->in.size;
+  p->in.m = p->spare;
+  p->in.size = p->sparesize;
+  p->in.n = 0;
+  pthread_mutex_unlock(&p->in.lock);
+  p->spare = m;
+  p->sparesize = size;
+  for (i = 0; i < n; i++) {
+    if (m[i].anti)
+      annihilate(p, &m[i].ev);
+    else {
+      rollback(p, &m[i].ev);
+      evheap_insert(&p->pending, &m[i].ev);
+    }
+  }
+  atomic_fetch_sub(&p->eng->inflight, n);
+}
+
+static void handle(struct twpart *p, const struct fevent *ev)
+{
+  struct entity *e = &p->eng->model->ent[ev->dst];
+  struct logent *le;
+
+  if (p->nlog == p->logsize) {
+    p->logsize = p->logsize ? 2 * p->logsize : 256;
+    p->log = xrealloc(p->log, p->logsize * sizeof(struct logent));
+  }
+  if (p->nctx + e->ctxsize > p->ctxsize) {
+    p->ctxsize = 2 * (p->nctx + e->ctxsize);
+    p->ctxlog = xrealloc(p->ctxlog, p->ctxsize);
+  }
+  le = &p->log[p->nlog++];
+  le->ev = *ev;
+  le->saved = e->st;
+  le->ctxoff = p->nctx;
+  le->sentmark = p->sent.n;
+  memcpy(p->ctxlog + p->nctx, e->ctx, e->ctxsize);
+  p->nctx += e->ctxsize;
+
+  p->logging = 1;
+  flows_handle(p->eng->model, ev);
+  p->logging = 0;
+  p->st.processed++;
+}
+
+/* forget the logged events before gvt: they can no longer be undone */
+static void fossils(struct twpart *p, double gvt)
+{
+  int k, i, sent;
+  size_t ctx;
+
+  for (k = 0; k < p->nlog && p->log[k].ev.time < gvt; k++)
+    ;
+  if (k == 0)
+    return;
+  sent = k < p->nlog ? p->log[k].sentmark : p->sent.n;
+  ctx = k < p->nlog ? p->log[k].ctxoff : p->nctx;
+  memmove(p->log, p->log + k, (p->nlog - k) * sizeof(struct logent));
+  p->nlog -= k;
+  memmove(p->sent.ev, p->sent.ev + sent, (p->sent.n - sent) * sizeof(struct fevent));
+  p->sent.n -= sent;
+  memmove(p->ctxlog, p->ctxlog + ctx, p->nctx - ctx);
+  p->nctx -= ctx;
+  for (i = 0; i < p->nlog; i++) {
+    p->log[i].sentmark -= sent;
+    p->log[i].ctxoff -= ctx;
+  }
+}
+
+static void *partition(void *arg)
+{
+  struct twpart *p = arg;
+  struct tw *eng = p->eng;
+  double stop = eng->model->cfg.stop_time > 0 ? eng->model->cfg.stop_time : INFINITY;
+  double gvt = 0.0;
+  struct fevent ev;
+  int quiet, q, n;
+
+  for (;;) {
+    /* run ahead optimistically */
+    for (n = 0; n < TW_BATCH; n++) {
+      if (n % TW_POLL == 0)
+        drain(p);
+      if (p->pending.n == 0 || p->pending.ev[0].time >= gvt + TW_WINDOW ||
+          p->pending.ev[0].time > stop)
+        break;
+      ev = evheap_pop(&p->pending);
+      handle(p, &ev);
+    }
+
+    /* GVT: stop together and deliver everything still in flight */
+    pthread_barrier_wait(&eng->barrier);
+    do {
+      drain(p);
+      pthread_barrier_wait(&eng->barrier);
+      quiet = atomic_load(&eng->inflight) == 0;
+      pthread_barrier_wait(&eng->barrier);
+    } while (!quiet);
+    eng->mins[p->id] = p->pending.n ? p->pending.ev[0].time : INFINITY;
+    pthread_barrier_wait(&eng->barrier);
+    for (gvt = INFINITY, q = 0; q < eng->nparts; q++)
+      if (eng->mins[q] < gvt)
+        gvt = eng->mins[q];
+    if (p->id == 0)
+      p->st.rounds++;
+    fossils(p, gvt);
+    if (gvt == INFINITY || gvt > stop)
+      break;
+  }
+  return NULL;
+}
+
+void tw_run(struct flows *m, int nparts, struct twstats *st)
+{
+  struct tw eng;
+  pthread_t *tid;
+  int i;
+
+  if (nparts < 1)
+    nparts = 1;
+  eng.model = m;
+  eng.nparts = nparts;
+  atomic_init(&eng.inflight, 0);
+  eng.parts = calloc(nparts, sizeof(struct twpart));
+  eng.mins = calloc(nparts, sizeof(double));
+  tid = calloc(nparts, sizeof(pthread_t));
+  if (eng.parts == NULL || eng.mins == NULL || tid == NULL) {
+    printf("memory allocation for partitions failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nparts; i++) {
+    eng.parts[i].id = i;
+    eng.parts[i].eng = &eng;
+    pthread_mutex_init(&eng.parts[i].in.lock, NULL);
+  }
+  /* the same placement as the conservative engine */
+  for (i = 0; i < m->nent; i++) {
+    struct entity *e = &m->ent[i];
+    e->owner = &eng.parts[(e->flow + (e->side == B ? nparts / 2 : 0)) % nparts];
+  }
+  m->schedule = tw_schedule;
+  flows_start(m);
+
+  pthread_barrier_init(&eng.barrier, NULL, nparts);
+  for (i = 1; i < nparts; i++)
+    if (pthread_create(&tid[i], NULL, partition, &eng.parts[i]) != 0) {
+      printf("cannot start partition thread\n");
+      exit(EXIT_FAILURE);
+    }
+  partition(&eng.parts[0]);     /* this thread runs partition 0 */
+  for (i = 1; i < nparts; i++)
+    pthread_join(tid[i], NULL);
+  pthread_barrier_destroy(&eng.barrier);
+
+  memset(st, 0, sizeof(*st));
+  for (i = 0; i < nparts; i++) {
+    struct twpart *p = &eng.parts[i];
+
+    st->rounds += p->st.rounds;
+    st->processed += p->st.processed;
+    st->rolledback += p->st.rolledback;
+    st->rollbacks += p->st.rollbacks;
+    st->antimessages += p->st.antimessages;
+    pthread_mutex_destroy(&p->in.lock);
+    free(p->in.m);
+    free(p->spare);
+    free(p->pending.ev);
+    free(p->log);
+    free(p->sent.ev);
+    free(p->ctxlog);
+  }
+  free(eng.parts);
+  free(eng.mins);
+  free(tid);
+}
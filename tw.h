@@ -0,0 +1,24 @@
+#ifndef TW_H
+#define TW_H
+
+#include "flows.h"
+
+/* ******************************************************************
+   Optimistic (Time Warp) parallel engine for the multi-flow model.
+**********************************************************************/
+
+struct twstats {
+  long rounds;                  /* GVT computations */
+  long processed;               /* events handled, including undone ones */
+  long rolledback;              /* events undone */
+  long rollbacks;
+  long antimessages;
+};
+
+/* Run the model to the end (or to cfg.stop_time) on 'nparts' threads,
+   each running its events optimistically and rolling back when an
+   event from another thread arrives in its past.  The result is the
+   same as that of pdes_run(). */
+extern void tw_run(struct flows *m, int nparts, struct twstats *st);
+
+#endif
@@ -0,0 +1,491 @@
+#define _GNU_SOURCE             /* recvmmsg(), sendmmsg() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include "emulator.h"
+#include "rng.h"
+#include "workload.h"
+#include "realtime.h"
+#include "udp.h"
+
+/* ******************************************************************
+   UDP loopback backend.  Each entity is a thread with an epoll loop
+   over its socket, a timerfd for its one timer and (A) the application
+   threads' eventfd or (B) an eventfd A signals when the run is over.
+   Arriving packets are drained with recvmmsg(), as many as have come.
+   The packets an entity sends while handling them (or a timeout, or
+   messages from layer 5) are queued and leave together before it waits
+   again: in one sendmmsg() call, or with UDP generic segmentation
+   offload in one send() of all of them back to back, which the kernel
+   cuts into datagrams of a packet each, so a window's worth of packets
+   costs one trip into the kernel instead of one each.
+
+   The channel's loss and corruption are decided by the sender before
+   the packet leaves, from the same keyed numbers an emulated run
+   draws, so the protocol faces the impairments it is tested against;
+   the kernel adds its own delay, and drops packets when a socket
+   buffer overflows, which the protocol has to recover from as well.
+   Packets go out in host byte order: both ends are this program.
+
+   The run is over when the application threads are done and A's timer
+   is not running, that is when A has nothing left unacknowledged.
+**********************************************************************/
+
+#define UDP_RCVBUF (4 << 20)    /* socket receive buffer asked for */
+
+struct udprun;
+
+struct uside {
+  struct udprun *run;
+  int side;                     /* A or B */
+  int sock, tfd, ep;
+  void *ctx;
+  struct host host;
+  struct protostats stats;
+  uint64_t key, ntx;            /* channel stream of this direction */
+  struct pkt out[UDP_BATCH];    /* packets waiting to be sent */
+  int nout;
+  long long ntolayer3, nlost, ncorrupt, delivered, events, sends;
+  long long fed, offered;       /* messages handed down (A) */
+  int timeron;
+  double timerdue;              /* seconds since the start */
+  double latency_sum, latency_max;
+  double late_sum, late_max;
+  double cpu;                   /* CPU seconds of the thread */
+  int stopreason;
+};
+
+struct udprun {
+  const struct protocol *proto;
+  struct simconfig cfg;
+  double scale;
+  struct udpconfig ucfg;        /* gso cleared if the kernel cannot */
+  struct timespec t0;
+  struct rtapp *app;
+  int quit;                     /* eventfd that ends B's loop */
+  struct uside side[2];
+};
+
+static void fail(const char *what)
+{
+  printf("UDP backend: %s: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/* A send failed with ENOBUFS: the kernel had no room for the packets.
+   Wait until the socket takes more and let the other side run (it is
+   the one that drains them) before trying again, rather than spin. */
+static void backoff(struct uside *u)
+{
+  struct pollfd p = { u->sock, POLLOUT, 0 };
+
+  while (poll(&p, 1, -1) < 0 && errno == EINTR)
+    ;
+  sched_yield();
+}
+
+/* send the packets u has queued */
+static void flush(struct uside *u)
+{
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  int i, n, sent = 0;
+
+  if (u->nout == 0)
+    return;
+  if (u->run->ucfg.gso) {
+    while (send(u->sock, u->out, u->nout * sizeof(struct pkt), 0) < 0) {
+      if (errno == ENOBUFS)
+        backoff(u);
+      else if (errno != EINTR)
+        fail("send");
+    }
+    u->sends++;
+    u->nout = 0;
+    return;
+  }
+  for (i = 0; i < u->nout; i++) {
+    iov[i].iov_base = &u->out[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (sent < u->nout) {
+    n = sendmmsg(u->sock, msgs + sent, u->nout - sent, 0);
+    if (n < 0) {
+      if (errno == ENOBUFS)
+        backoff(u);
+      else if (errno != EINTR)
+        fail("sendmmsg");
+      continue;
+    }
+    sent += n;
+    u->sends++;
+  }
+  u->nout = 0;
+}
+
+/*************************** the host ******************************/
+
+static void udp_tolayer3(void *eng, int AorB, struct pkt packet)
+{
+  struct uside *u = eng;
+  int corrupted;
+
+  u->ntolayer3++;
+  if (channel_fate(&u->run->cfg, u->key, u->ntx++, AorB, &packet, &corrupted) ==
+      CHANNEL_LOST) {
+    u->nlost++;
+    return;
+  }
+  u->ncorrupt += corrupted;
+  u->out[u->nout++] = packet;
+  if (u->nout == u->run->ucfg.batch)
+    flush(u);
+}
+
+static void udp_tolayer5(void *eng, int AorB, char datasent[20])
+{
+  struct uside *u = eng;
+  double latency;
+
+  if (AorB != B)
+    return;
+  u->delivered++;
+  latency = rt_latency(&u->run->t0, datasent);
+  u->latency_sum += latency;
+  if (latency > u->latency_max)
+    u->latency_max = latency;
+}
+
+static void udp_starttimer(void *eng, int AorB, double increment)
+{
+  struct uside *u = eng;
+  struct itimerspec arm;
+  double seconds = increment * u->run->scale;
+
+  if (u->timeron) {
+    if (TRACE>=0)
+      printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  u->timeron = 1;
+  u->timerdue = rt_since(&u->run->t0) + seconds;
+  memset(&arm, 0, sizeof(arm));
+  arm.it_value.tv_sec = (time_t)seconds;
+  arm.it_value.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+  if (arm.it_value.tv_sec == 0 && arm.it_value.tv_nsec == 0)
+    arm.it_value.tv_nsec = 1;   /* zero would disarm it */
+  timerfd_settime(u->tfd, 0, &arm, NULL);
+}
+
+static void udp_stoptimer(void *eng, int AorB)
+{
+  struct uside *u = eng;
+  struct itimerspec arm;
+
+  if (!u->timeron) {
+    if (TRACE>=0)
+      printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  u->timeron = 0;
+  memset(&arm, 0, sizeof(arm));
+  timerfd_settime(u->tfd, 0, &arm, NULL);
+}
+
+static const struct hostops udpops = {
+  udp_tolayer3, udp_tolayer5, udp_starttimer, udp_stoptimer
+};
+
+/*************************** the entities ******************************/
+
+/* the greedy workload (see rt_feed()) */
+static void feed(struct uside *u)
+{
+  u->offered += rt_feed(u->run->proto, u->ctx, &u->stats, &u->fed,
+                        u->run->cfg.nsimmax, &u->run->t0);
+}
+
+/* take the packets that have arrived */
+static void receive(struct uside *u)
+{
+  const struct protocol *p = u->run->proto;
+  struct pkt pkts[UDP_BATCH];
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  int i, n;
+
+  for (i = 0; i < UDP_BATCH; i++) {
+    iov[i].iov_base = &pkts[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  for (;;) {
+    n = recvmmsg(u->sock, msgs, u->run->ucfg.batch, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno != EINTR)
+        fail("recvmmsg");
+      continue;
+    }
+    for (i = 0; i < n; i++) {
+      if (msgs[i].msg_len != sizeof(struct pkt))
+        continue;               /* not one of ours */
+      u->events++;
+      if (u->side == A)
+        p->A_input(u->ctx, pkts[i]);
+      else
+        p->B_input(u->ctx, pkts[i]);
+    }
+    if (n < u->run->ucfg.batch)
+      return;
+  }
+}
+
+static void timeout(struct uside *u)
+{
+  const struct protocol *p = u->run->proto;
+  uint64_t count;
+  double late;
+
+  if (read(u->tfd, &count, sizeof(count)) <= 0 || !u->timeron)
+    return;
+  u->timeron = 0;
+  late = rt_since(&u->run->t0) - u->timerdue;
+  u->late_sum += late;
+  if (late > u->late_max)
+    u->late_max = late;
+  u->events++;
+  if (u->side == A)
+    p->A_timerinterrupt(u->ctx);
+  else
+    p->B_timerinterrupt(u->ctx);
+}
+
+/* the loop of entity u, until the run is over */
+static void loop(struct uside *u)
+{
+  struct udprun *run = u->run;
+  const struct simconfig *cfg = &run->cfg;
+  struct epoll_event fired[3];
+  struct timespec cpu0, cpu1;
+  struct msg *m;
+  long long i, n;
+  double now, deadline = 0.0;
+  int k, nfired, wait, done, over = 0;
+
+  curhost = &u->host;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+  /* A stops the run at the first of the stop time and the budget */
+  if (u->side == A && cfg->stop_time > 0)
+    deadline = cfg->stop_time * run->scale;
+  if (u->side == A && cfg->wall_budget > 0 && (deadline == 0 || cfg->wall_budget < deadline))
+    deadline = cfg->wall_budget;
+  if (u->side == A && cfg->workload == WL_GREEDY)
+    feed(u);
+  while (!over) {
+    if (u->side == A) {
+      now = rt_since(&run->t0);
+      if (cfg->stop_time > 0 && now >= cfg->stop_time * run->scale) {
+        u->stopreason = STOP_TIME;
+        break;
+      }
+      if (cfg->wall_budget > 0 && now >= cfg->wall_budget) {
+        u->stopreason = STOP_WALL;
+        break;
+      }
+      done = rtapp_take(run->app, &m, &n);
+      for (i = 0; i < n; i++) {
+        u->offered++;
+        run->proto->A_output(u->ctx, m[i]);
+      }
+      if (done && !u->timeron &&
+          (cfg->workload != WL_GREEDY || u->fed == cfg->nsimmax)) {
+        u->stopreason = STOP_DRAINED;
+        break;
+      }
+    }
+
+    flush(u);
+    wait = -1;
+    if (deadline > 0) {
+      wait = 1 + (int)(1000 * (deadline - rt_since(&run->t0)));
+      if (wait < 0)
+        wait = 0;
+    }
+    nfired = epoll_wait(u->ep, fired, 3, wait);
+    if (nfired < 0 && errno != EINTR)
+      fail("epoll_wait");
+    for (k = 0; k < nfired; k++)
+      if (fired[k].data.fd == run->quit)
+        over = 1;
+    receive(u);
+    timeout(u);
+    if (u->side == A && cfg->workload == WL_GREEDY)
+      feed(u);
+  }
+  flush(u);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+  u->cpu = (cpu1.tv_sec - cpu0.tv_sec) + 1e-9 * (cpu1.tv_nsec - cpu0.tv_nsec);
+  curhost = NULL;
+}
+
+static void *runb(void *arg)
+{
+  loop(arg);
+  return NULL;
+}
+
+/* a socket on the loopback interface, at a port of the kernel's choosing */
+static int opensocket(struct udprun *run, struct sockaddr_in *addr)
+{
+  socklen_t len = sizeof(*addr);
+  int s = socket(AF_INET, SOCK_DGRAM, 0), size = UDP_RCVBUF;
+  int segment = sizeof(struct pkt);
+
+  if (s < 0)
+    fail("socket");
+  setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  if (run->ucfg.gso &&
+      setsockopt(s, IPPROTO_UDP, UDP_SEGMENT, &segment, sizeof(segment)) < 0) {
+    printf("UDP generic segmentation offload not available (%s), using sendmmsg()\n",
+           strerror(errno));
+    run->ucfg.gso = 0;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(s, (struct sockaddr *)addr, sizeof(*addr)) < 0 ||
+      getsockname(s, (struct sockaddr *)addr, &len) < 0)
+    fail("bind");
+  return s;
+}
+
+static void watch(int ep, int fd)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+    fail("epoll_ctl");
+}
+
+void udp_run(const struct protocol *proto, const struct simconfig *cfg,
+             double scale, int threads, const struct udpconfig *ucfg,
+             struct rtresult *res)
+{
+  struct host *prevhost = curhost;
+  struct sockaddr_in addr[2];
+  struct udprun run;
+  pthread_t tid;
+  uint64_t one = 1;
+  int i;
+
+  memset(res, 0, sizeof(*res));
+  memset(&run, 0, sizeof(run));
+  run.proto = proto;
+  run.cfg = *cfg;
+  run.scale = scale;
+  run.ucfg = *ucfg;
+  if ((run.quit = eventfd(0, EFD_NONBLOCK)) < 0)
+    fail("eventfd");
+  for (i = A; i <= B; i++) {
+    struct uside *u = &run.side[i];
+
+    u->run = &run;
+    u->side = i;
+    u->sock = opensocket(&run, &addr[i]);
+    u->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    u->ep = epoll_create1(0);
+    if (u->tfd < 0 || u->ep < 0)
+      fail("timerfd or epoll");
+    u->ctx = calloc(1, (i == A ? proto->A_size : proto->B_size) + 1);
+    if (u->ctx == NULL) {
+      printf("memory allocation for protocol state failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    u->host.ops = &udpops;
+    u->host.eng = u;
+    u->host.stats = &u->stats;
+    u->key = rng_key(cfg->seed, 1 + i);
+    watch(u->ep, u->sock);
+    watch(u->ep, u->tfd);
+  }
+  for (i = A; i <= B; i++)
+    if (connect(run.side[i].sock, (struct sockaddr *)&addr[!i], sizeof(addr[!i])) < 0)
+      fail("connect");
+  watch(run.side[B].ep, run.quit);
+
+  curhost = &run.side[A].host;
+  proto->A_init(run.side[A].ctx);
+  curhost = &run.side[B].host;
+  proto->B_init(run.side[B].ctx);
+  curhost = prevhost;
+
+  clock_gettime(CLOCK_MONOTONIC, &run.t0);
+  run.app = rtapp_start(cfg, scale, &run.t0, threads);
+  watch(run.side[A].ep, rtapp_fd(run.app));
+  if (pthread_create(&tid, NULL, runb, &run.side[B]) != 0) {
+    printf("cannot start the thread of B\n");
+    exit(EXIT_FAILURE);
+  }
+  loop(&run.side[A]);
+  res->wall = rt_since(&run.t0);
+  if (write(run.quit, &one, sizeof(one)) != sizeof(one))
+    fail("write");
+  pthread_join(tid, NULL);
+  curhost = prevhost;
+  rtapp_stop(run.app);
+
+  res->stopreason = run.side[A].stopreason;
+  res->time = res->wall / scale;
+  for (i = A; i <= B; i++) {
+    struct uside *u = &run.side[i];
+
+    res->offered += u->offered;
+    res->delivered += u->delivered;
+    res->ntolayer3 += u->ntolayer3;
+    res->nlost += u->nlost;
+    res->ncorrupt += u->ncorrupt;
+    res->events += u->events;
+    res->sends += u->sends;
+    res->cpu += u->cpu;
+    res->latency_avg += u->latency_sum;
+    if (u->latency_max > res->latency_max)
+      res->latency_max = u->latency_max;
+    res->late_avg += u->late_sum;
+    if (u->late_max > res->late_max)
+      res->late_max = u->late_max;
+    res->stats.total_ACKs_received += u->stats.total_ACKs_received;
+    res->stats.packets_resent += u->stats.packets_resent;
+    res->stats.new_ACKs += u->stats.new_ACKs;
+    res->stats.packets_received += u->stats.packets_received;
+    res->stats.window_full += u->stats.window_full;
+    close(u->sock);
+    close(u->tfd);
+    close(u->ep);
+    free(u->ctx);
+  }
+  res->latency_avg = res->delivered ? res->latency_avg / res->delivered : 0.0;
+  res->late_avg = res->events ? res->late_avg / res->events : 0.0;
+  close(run.quit);
+}
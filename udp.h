@@ -0,0 +1,31 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include "emulator.h"
+#include "realtime.h"
+
+/* ******************************************************************
+   UDP loopback backend for the real-time mode: A and B run on threads
+   of their own, each with a UDP socket on 127.0.0.1, and their packets
+   cross the kernel's network stack.
+**********************************************************************/
+
+#define UDP_BATCH 64            /* most packets sent or taken per call */
+
+struct udpconfig {
+  int batch;                    /* packets per sendmmsg() and recvmmsg(),
+                                   1 to UDP_BATCH; 1 sends each alone */
+  int gso;                      /* send each batch as one UDP GSO datagram
+                                   the kernel cuts up, where it can */
+};
+
+/* Run proto as realtime_run() does, but over the sockets: tolayer3()
+   applies the loss and corruption of cfg's channel (keyed numbers) and
+   queues what survives, to go out with the other packets of the same
+   turn of the loop, and the delay is whatever the loopback takes.
+   A runs on the calling thread, B on another. */
+extern void udp_run(const struct protocol *proto, const struct simconfig *cfg,
+                    double scale, int threads, const struct udpconfig *ucfg,
+                    struct rtresult *res);
+
+#endif
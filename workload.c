@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "workload.h"
+
+/* ******************************************************************
+   Workload models.  Each turns the uniform numbers drawn for a message
+   into the gap before it, so the emulator and the multi-flow engines
+   share them and keyed runs stay reproducible whatever the model.
+   Message contents are the emulator's: the protocols carry fixed
+   20-byte messages, so the heavy-tailed sizes of WL_PARETO are counts
+   of messages per object rather than bytes.
+**********************************************************************/
+
+void workload_init(struct wlstate *st)
+{
+  st->n = 0;
+  st->onleft = 0.0;             /* the run opens with a silence */
+  st->left = 0;
+}
+
+/* exponential with the given mean, from uniform number 'which' */
+static double expo(double mean, double (*u)(void *, int), void *arg, int which)
+{
+  double x = u(arg, which);
+
+  if (x >= 1.0)                 /* rand() can return RAND_MAX */
+    x = 0.0;
+  return -mean * log1p(-x);
+}
+
+double workload_gap(const struct simconfig *cfg, struct wlstate *st, double now,
+                    double (*u)(void *arg, int which), void *arg)
+{
+  double gap, size;
+
+  switch (cfg->workload) {
+  case WL_POISSON:
+    gap = expo(cfg->lambda, u, arg, 0);
+    break;
+  case WL_CBR:
+    gap = cfg->lambda;
+    break;
+  case WL_ONOFF:
+    gap = expo(cfg->lambda, u, arg, 0);
+    if (gap <= st->onleft)
+      st->onleft -= gap;
+    else {
+      /* the burst ends first: a silence, then the next burst opens
+         with a message */
+      gap = st->onleft + expo(cfg->burst_off, u, arg, 2);
+      st->onleft = expo(cfg->burst_on, u, arg, 3);
+    }
+    break;
+  case WL_PARETO:
+    if (st->left > 0) {         /* the rest of the object comes at once */
+      st->left--;
+      gap = 0.0;
+      break;
+    }
+    gap = expo(cfg->lambda, u, arg, 0);
+    size = u(arg, 2);
+    size = size < 1.0 ? floor(pow(1.0 - size, -1.0 / cfg->pareto_shape)) : 1.0;
+    st->left = size < 1e18 ? (long long)size - 1 : (long long)1e18;
+    break;
+  case WL_GREEDY:               /* the engine feeds the sender itself */
+    return WL_END;
+  case WL_TRACE:
+    if (st->n >= cfg->ntrace)
+      return WL_END;
+    gap = cfg->trace[st->n] > now ? cfg->trace[st->n] - now : 0.0;
+    break;
+  default:
+    gap = cfg->lambda*u(arg, 0)*2;  /* uniform on [0,2*lambda] */
+    break;
+  }
+  st->n++;
+  return gap;
+}
+
+static int loadtrace(struct simconfig *cfg, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  double *t = NULL, *p, x;
+  long long n = 0, size = 0;
+
+  if (f == NULL) {
+    printf("cannot open arrival trace %s\n", path);
+    return 0;
+  }
+  while (fscanf(f, "%lf", &x) == 1) {
+    if (n == size) {
+      size = size ? 2 * size : 1024;
+      if ((p = realloc(t, size * sizeof(double))) == NULL) {
+        printf("memory allocation for the arrival trace failed.\n");
+        exit(EXIT_FAILURE);
+      }
+      t = p;
+    }
+    t[n++] = x;
+  }
+  if (!feof(f)) {
+    printf("arrival trace %s: not a number after %lld times\n", path, n);
+    fclose(f);
+    free(t);
+    return 0;
+  }
+  fclose(f);
+  cfg->trace = t;
+  cfg->ntrace = n;
+  return 1;
+}
+
+int workload_parse(struct simconfig *cfg, const char *spec)
+{
+  if (strcmp(spec, "uniform") == 0)
+    cfg->workload = WL_UNIFORM;
+  else if (strcmp(spec, "poisson") == 0)
+    cfg->workload = WL_POISSON;
+  else if (strcmp(spec, "cbr") == 0)
+    cfg->workload = WL_CBR;
+  else if (strcmp(spec, "greedy") == 0)
+    cfg->workload = WL_GREEDY;
+  else if (sscanf(spec, "onoff:%f:%f", &cfg->burst_on, &cfg->burst_off) == 2)
+    cfg->workload = WL_ONOFF;
+  else if (sscanf(spec, "pareto:%f", &cfg->pareto_shape) == 1 && cfg->pareto_shape > 0)
+    cfg->workload = WL_PARETO;
+  else if (strncmp(spec, "trace:", 6) == 0 && loadtrace(cfg, spec + 6))
+    cfg->workload = WL_TRACE;
+  else
+    return 0;
+  return 1;
+}
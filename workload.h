@@ -0,0 +1,51 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "emulator.h"
+
+/* ******************************************************************
+   Workload models: when messages come down from layer 5 at A.  The
+   model and its parameters are part of the simconfig; cfg.lambda is
+   always the mean gap between messages (within a burst for WL_ONOFF,
+   between objects for WL_PARETO).
+**********************************************************************/
+
+#define WL_UNIFORM  0           /* gaps uniform on [0, 2*lambda]: the original */
+#define WL_POISSON  1           /* gaps exponential */
+#define WL_CBR      2           /* a message every lambda exactly */
+#define WL_ONOFF    3           /* Poisson bursts of mean length burst_on,
+                                   silences of mean length burst_off */
+#define WL_PARETO   4           /* objects arrive as Poisson, each a
+                                   Pareto(pareto_shape) number of messages
+                                   handed down at once */
+#define WL_TRACE    5           /* at the times in cfg.trace */
+#define WL_GREEDY   6           /* always a message waiting: A is handed
+                                   messages whenever its window has room,
+                                   instead of at arrival times */
+
+#define WL_END      (-1.0)      /* no more messages */
+
+/* what a model remembers from one message to the next */
+struct wlstate {
+  long long n;                  /* messages generated so far */
+  double onleft;                /* WL_ONOFF: time left in the current burst */
+  long long left;               /* WL_PARETO: messages of the object to come */
+};
+
+extern void workload_init(struct wlstate *st);
+
+/* Time from now (the previous message, or the start) to the next
+   message, or WL_END.  u(arg, which) is uniform number 'which' of this
+   message: 0 for the gap, 2 and 3 for the model's other choices (1 is
+   the emulator's, for the direction).  A model draws only what it
+   uses, so the original one still makes exactly one draw. */
+extern double workload_gap(const struct simconfig *cfg, struct wlstate *st, double now,
+                           double (*u)(void *arg, int which), void *arg);
+
+/* Set the workload of cfg from a spec: uniform, poisson, cbr, greedy,
+   onoff:ON:OFF, pareto:SHAPE or trace:FILE, FILE holding one arrival
+   time per line in ascending order.  Returns 0 if the spec is none of
+   these or the trace cannot be read. */
+extern int workload_parse(struct simconfig *cfg, const char *spec);
+
+#endif